@@ -0,0 +1,10 @@
+#version 410 core
+
+uniform vec3 col;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    fragColor = vec4(col, 1.0);
+}
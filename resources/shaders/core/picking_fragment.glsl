@@ -0,0 +1,10 @@
+#version 410 core
+
+uniform uvec2 key;
+
+out uvec2 fragKey;
+
+void main(void)
+{
+    fragKey = key;
+}
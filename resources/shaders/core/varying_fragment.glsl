@@ -0,0 +1,10 @@
+#version 410 core
+
+in vec3 outColor;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    fragColor = vec4(outColor, 1.0);
+}
@@ -0,0 +1,34 @@
+#version 410 core
+
+// Expands lines to screen space quads, as core profiles have no wide lines
+layout(lines) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+in vec3 vertColor[];
+uniform vec2 viewport;
+uniform float lineWidth;
+
+out vec3 outColor;
+
+void main(void)
+{
+    vec4 a = gl_in[0].gl_Position;
+    vec4 b = gl_in[1].gl_Position;
+
+    vec2 dir = (b.xy / b.w - a.xy / a.w) * viewport;
+    if (dir == vec2(0.0))
+        return;
+    vec2 offset = normalize(vec2(-dir.y, dir.x)) * lineWidth / viewport;
+
+    outColor = vertColor[0];
+    gl_Position = vec4(a.xy + offset * a.w, a.zw);
+    EmitVertex();
+    gl_Position = vec4(a.xy - offset * a.w, a.zw);
+    EmitVertex();
+    outColor = vertColor[1];
+    gl_Position = vec4(b.xy + offset * b.w, b.zw);
+    EmitVertex();
+    gl_Position = vec4(b.xy - offset * b.w, b.zw);
+    EmitVertex();
+    EndPrimitive();
+}
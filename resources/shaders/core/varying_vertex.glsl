@@ -0,0 +1,13 @@
+#version 410 core
+
+in vec3 vertexPosition;
+in vec3 vertexColor;
+uniform mat4 mvp;
+
+out vec3 vertColor;
+
+void main(void)
+{
+    vertColor = vertexColor;
+    gl_Position = mvp * vec4(vertexPosition, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 130
+
+uniform uvec2 key;
+
+out uvec2 fragKey;
+
+void main(void)
+{
+    fragKey = key;
+}
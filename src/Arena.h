@@ -0,0 +1,56 @@
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#define ARENA_BLOCK_SIZE 256
+
+typedef unsigned int uint;
+
+// Allocates objects of one type contiguously, in blocks of ARENA_BLOCK_SIZE, and destroys them
+// all at once. Objects can not be freed individually.
+template <typename T>
+class Arena
+{
+public:
+    Arena() : used(ARENA_BLOCK_SIZE) { }
+    ~Arena() { clear(); }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template <typename... Args>
+    T *create(Args&&... args)
+    {
+        if (used == ARENA_BLOCK_SIZE)
+        {
+            blocks.push_back(static_cast<T *>(::operator new(ARENA_BLOCK_SIZE * sizeof(T))));
+            used = 0;
+        }
+
+        return new (blocks.back() + used++) T(std::forward<Args>(args)...);
+    }
+
+    // Destroys the objects in reverse order of creation, and releases the blocks
+    void clear()
+    {
+        for (int b = (int) blocks.size() - 1; b >= 0; b--)
+        {
+            uint n = b == (int) blocks.size() - 1 ? used : ARENA_BLOCK_SIZE;
+            for (uint i = n; i > 0; i--)
+                blocks[b][i-1].~T();
+            ::operator delete(blocks[b]);
+        }
+
+        blocks.clear();
+        used = ARENA_BLOCK_SIZE;
+    }
+
+private:
+    std::vector<T *> blocks;
+    uint used;
+};
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <numeric>
+
+#include "BVH.h"
+
+#define LEAF_SIZE 4
+
+
+void BVH::build(const std::vector<box> &boxes)
+{
+    nodes.clear();
+    prims.resize(boxes.size());
+    std::iota(prims.begin(), prims.end(), 0);
+
+    std::vector<QVector3D> centers;
+    centers.reserve(boxes.size());
+    for (auto &b : boxes)
+        centers.push_back((b.lo + b.hi) / 2);
+
+    if (!boxes.empty())
+    {
+        nodes.reserve(2 * boxes.size() / LEAF_SIZE + 1);
+        buildNode(boxes, centers, 0, boxes.size());
+    }
+
+    _built = true;
+}
+
+
+uint BVH::buildNode(const std::vector<box> &boxes, std::vector<QVector3D> &centers, uint first, uint count)
+{
+    uint idx = nodes.size();
+    nodes.push_back({boxes[prims[first]].lo, boxes[prims[first]].hi, first, count});
+
+    QVector3D lo = nodes[idx].lo, hi = nodes[idx].hi;
+    QVector3D clo = centers[prims[first]], chi = clo;
+    for (uint i = first + 1; i < first + count; i++)
+    {
+        const box &b = boxes[prims[i]];
+        const QVector3D &c = centers[prims[i]];
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = std::min(lo[k], b.lo[k]);
+            hi[k] = std::max(hi[k], b.hi[k]);
+            clo[k] = std::min(clo[k], c[k]);
+            chi[k] = std::max(chi[k], c[k]);
+        }
+    }
+    nodes[idx].lo = lo;
+    nodes[idx].hi = hi;
+
+    if (count <= LEAF_SIZE)
+        return idx;
+
+    // Split at the median along the axis where the centers are most spread out
+    QVector3D extent = chi - clo;
+    int axis = 0;
+    if (extent[1] > extent[axis])
+        axis = 1;
+    if (extent[2] > extent[axis])
+        axis = 2;
+
+    uint half = count / 2;
+    std::nth_element(prims.begin() + first, prims.begin() + first + half, prims.begin() + first + count,
+                     [&centers, axis] (uint a, uint b) { return centers[a][axis] < centers[b][axis]; });
+
+    buildNode(boxes, centers, first, half);
+    uint right = buildNode(boxes, centers, first + half, count - half);
+
+    nodes[idx].first = right;
+    nodes[idx].count = 0;
+
+    return idx;
+}
+
+
+bool BVH::rayBox(QVector3D orig, QVector3D inv, float tmax, QVector3D lo, QVector3D hi)
+{
+    float tmin = 0.0;
+    for (int k = 0; k < 3; k++)
+    {
+        float t0 = (lo[k] - orig[k]) * inv[k];
+        float t1 = (hi[k] - orig[k]) * inv[k];
+        if (t0 > t1)
+            std::swap(t0, t1);
+
+        // NaN from 0 * inf fails both comparisons and leaves the interval untouched
+        if (t0 > tmin)
+            tmin = t0;
+        if (t1 < tmax)
+            tmax = t1;
+        if (tmin > tmax)
+            return false;
+    }
+
+    return true;
+}
+
+
+bool BVH::outside(const QVector4D &plane, QVector3D lo, QVector3D hi)
+{
+    // Test the corner farthest along the plane normal
+    QVector3D p(plane.x() >= 0 ? hi.x() : lo.x(),
+                plane.y() >= 0 ? hi.y() : lo.y(),
+                plane.z() >= 0 ? hi.z() : lo.z());
+
+    return QVector3D::dotProduct(plane.toVector3D(), p) + plane.w() < 0;
+}
@@ -0,0 +1,108 @@
+#include <vector>
+#include <QVector3D>
+#include <QVector4D>
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+typedef struct { QVector3D lo, hi; } box;
+
+class BVH
+{
+public:
+    BVH() { }
+    ~BVH() { }
+
+    void build(const std::vector<box> &boxes);
+    inline bool built() { return _built; }
+
+    // Calls visit(prim) for the primitives in each leaf whose box, grown by pad, is hit by the ray
+    // orig + t*dir with 0 <= t <= tmax. The return value of visit is the new tmax. Leaves hold a
+    // few primitives each, so visit must do its own exact test.
+    template <typename F>
+    void ray(QVector3D orig, QVector3D dir, float tmax, float pad, F visit);
+
+    // Calls visit(prim) for the primitives in each leaf whose box is not completely outside one of
+    // the planes. A point p is inside a plane (a,b,c,d) if a*x + b*y + c*z + d >= 0.
+    template <typename F>
+    void frustum(const std::vector<QVector4D> &planes, F visit);
+
+private:
+    // Leaves have count > 0 and own prims[first, first+count). Inner nodes have count == 0, their
+    // left child follows immediately and the right child is at index first.
+    typedef struct { QVector3D lo, hi; uint first, count; } node;
+
+    std::vector<node> nodes;
+    std::vector<uint> prims;
+    bool _built = false;
+
+    uint buildNode(const std::vector<box> &boxes, std::vector<QVector3D> &centers, uint first, uint count);
+
+    static bool rayBox(QVector3D orig, QVector3D inv, float tmax, QVector3D lo, QVector3D hi);
+    static bool outside(const QVector4D &plane, QVector3D lo, QVector3D hi);
+};
+
+
+template <typename F>
+void BVH::ray(QVector3D orig, QVector3D dir, float tmax, float pad, F visit)
+{
+    if (nodes.empty())
+        return;
+
+    QVector3D inv(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+    QVector3D grow(pad, pad, pad);
+
+    std::vector<uint> stack = {0};
+    while (!stack.empty())
+    {
+        const node &n = nodes[stack.back()];
+        uint idx = stack.back();
+        stack.pop_back();
+
+        if (!rayBox(orig, inv, tmax, n.lo - grow, n.hi + grow))
+            continue;
+
+        if (n.count > 0)
+            for (uint i = n.first; i < n.first + n.count; i++)
+                tmax = visit(prims[i]);
+        else
+        {
+            stack.push_back(n.first);
+            stack.push_back(idx + 1);
+        }
+    }
+}
+
+
+template <typename F>
+void BVH::frustum(const std::vector<QVector4D> &planes, F visit)
+{
+    if (nodes.empty())
+        return;
+
+    std::vector<uint> stack = {0};
+    while (!stack.empty())
+    {
+        const node &n = nodes[stack.back()];
+        uint idx = stack.back();
+        stack.pop_back();
+
+        bool out = false;
+        for (auto &p : planes)
+            if ((out = outside(p, n.lo, n.hi)))
+                break;
+        if (out)
+            continue;
+
+        if (n.count > 0)
+            for (uint i = n.first; i < n.first + n.count; i++)
+                visit(prims[i]);
+        else
+        {
+            stack.push_back(n.first);
+            stack.push_back(idx + 1);
+        }
+    }
+}
+
+#endif /* _BVH_H_ */
@@ -0,0 +1,127 @@
+#include <algorithm>
+
+#include "BitSet.h"
+
+
+BitSet::BitSet(uint n, bool value)
+    : words((n + 63) / 64, value ? ~(uint64_t) 0 : 0)
+    , _capacity(n)
+    , _size(value ? n : 0)
+{
+    trim();
+}
+
+
+void BitSet::insert(std::initializer_list<uint> bits)
+{
+    for (auto i : bits)
+        insert(i);
+}
+
+
+void BitSet::clear()
+{
+    std::fill(words.begin(), words.end(), 0);
+    _size = 0;
+}
+
+
+void BitSet::fill()
+{
+    std::fill(words.begin(), words.end(), ~(uint64_t) 0);
+    trim();
+    _size = _capacity;
+}
+
+
+void BitSet::invert()
+{
+    for (auto &w : words)
+        w = ~w;
+    trim();
+    _size = _capacity - _size;
+}
+
+
+void BitSet::insert(const BitSet &other)
+{
+    assert(_capacity == other._capacity);
+    for (uint i = 0; i < words.size(); i++)
+        words[i] |= other.words[i];
+    recount();
+}
+
+
+void BitSet::erase(const BitSet &other)
+{
+    assert(_capacity == other._capacity);
+    for (uint i = 0; i < words.size(); i++)
+        words[i] &= ~other.words[i];
+    recount();
+}
+
+
+void BitSet::intersect(const BitSet &other)
+{
+    assert(_capacity == other._capacity);
+    for (uint i = 0; i < words.size(); i++)
+        words[i] &= other.words[i];
+    recount();
+}
+
+
+BitSet::delta BitSet::diff(const BitSet &other) const
+{
+    assert(_capacity == other._capacity);
+    delta d;
+    for (uint i = 0; i < words.size(); i++)
+        if (words[i] != other.words[i])
+            d.push_back(std::make_pair(i, words[i] ^ other.words[i]));
+    return d;
+}
+
+
+void BitSet::toggle(const delta &d)
+{
+    for (auto &w : d)
+    {
+        assert(w.first < words.size());
+        _size -= __builtin_popcountll(words[w.first]);
+        words[w.first] ^= w.second;
+        _size += __builtin_popcountll(words[w.first]);
+    }
+}
+
+
+uint BitSet::next(uint i) const
+{
+    if (i >= _capacity)
+        return _capacity;
+
+    uint w = i >> 6;
+    uint64_t word = words[w] & (~(uint64_t) 0 << (i & 63));
+
+    while (!word)
+    {
+        if (++w == words.size())
+            return _capacity;
+        word = words[w];
+    }
+
+    return 64 * w + __builtin_ctzll(word);
+}
+
+
+void BitSet::recount()
+{
+    _size = 0;
+    for (auto w : words)
+        _size += __builtin_popcountll(w);
+}
+
+
+void BitSet::trim()
+{
+    if (_capacity & 63)
+        words.back() &= ((uint64_t) 1 << (_capacity & 63)) - 1;
+}
@@ -0,0 +1,99 @@
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#ifndef _BITSET_H_
+#define _BITSET_H_
+
+typedef unsigned int uint;
+
+// A dense set of indices 0..n-1, stored one bit per index in 64-bit words. The number of set bits
+// is maintained on every change, so size() and empty() are constant time.
+class BitSet
+{
+public:
+    BitSet(uint n = 0, bool value = false);
+    ~BitSet() { }
+
+    // Iterates over the set bits in increasing order
+    class iterator
+    {
+    public:
+        iterator(const BitSet *set, uint i) : set(set), i(i) { }
+
+        inline uint operator*() const { return i; }
+        inline bool operator!=(const iterator &other) const { return i != other.i; }
+        inline iterator &operator++() { i = set->next(i + 1); return *this; }
+
+    private:
+        const BitSet *set;
+        uint i;
+    };
+
+    inline iterator begin() const { return iterator(this, next(0)); }
+    inline iterator end() const { return iterator(this, _capacity); }
+
+    inline uint capacity() const { return _capacity; }
+    inline uint size() const { return _size; }
+    inline bool empty() const { return _size == 0; }
+    inline bool full() const { return _size == _capacity; }
+
+    inline bool test(uint i) const { return i < _capacity && (words[i >> 6] >> (i & 63) & 1); }
+
+    inline void insert(uint i)
+    {
+        assert(i < _capacity);
+        uint64_t bit = (uint64_t) 1 << (i & 63);
+        if (!(words[i >> 6] & bit))
+        {
+            words[i >> 6] |= bit;
+            _size++;
+        }
+    }
+
+    inline void erase(uint i)
+    {
+        assert(i < _capacity);
+        uint64_t bit = (uint64_t) 1 << (i & 63);
+        if (words[i >> 6] & bit)
+        {
+            words[i >> 6] &= ~bit;
+            _size--;
+        }
+    }
+
+    void insert(std::initializer_list<uint> bits);
+    void clear();
+    void fill();
+    void invert();
+
+    // Word-parallel set operations, with sets of the same capacity
+    void insert(const BitSet &other);
+    void erase(const BitSet &other);
+    void intersect(const BitSet &other);
+
+    // The words that differ between two sets of the same capacity, as (word index, xor) pairs.
+    // Toggling a delta turns one set into the other, and toggling it again turns it back.
+    typedef std::vector<std::pair<uint, uint64_t>> delta;
+    delta diff(const BitSet &other) const;
+    void toggle(const delta &d);
+
+    // The first set bit at or after i, or capacity() if there is none
+    uint next(uint i) const;
+
+    // The raw words, with the unused high bits of the last word always zero. Suitable for upload
+    // to a buffer object.
+    inline const uint64_t *data() const { return words.data(); }
+    inline uint nWords() const { return words.size(); }
+
+private:
+    std::vector<uint64_t> words;
+    uint _capacity, _size;
+
+    void recount();
+    void trim();
+};
+
+#endif /* _BITSET_H_ */
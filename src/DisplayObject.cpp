@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <numeric>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QVector2D>
+
 #include "DisplayObject.h"
 
 const QVector3D FACE_COLOR_NORMAL    = QVector3D(0.737, 0.929, 1.000);
@@ -10,15 +16,23 @@ const QVector3D LINE_COLOR_SELECTED  = QVector3D(0.749, 0.620, 0.431);
 const QVector3D EDGE_COLOR_SELECTED  = QVector3D(0.776, 0.478, 0.427);
 const QVector3D POINT_COLOR_SELECTED = QVector3D(0.776, 0.478, 0.427);
 
-const QVector3D WHITE = QVector3D(1.0, 1.0, 1.0);
+const QVector3D FACE_COLOR_HOVER     = QVector3D(0.996, 0.957, 0.745);
+const QVector3D EDGE_COLOR_HOVER     = QVector3D(0.937, 0.545, 0.129);
+const QVector3D POINT_COLOR_HOVER    = QVector3D(0.937, 0.545, 0.129);
 
 
 #define LINE_WIDTH 1.1
 #define EDGE_WIDTH 2.0
 #define POINT_SIZE 10.0
 
+#define POLYGON_OFFSET_FACTOR 1.0
+#define POLYGON_OFFSET_UNITS 1.0
+
+const std::vector<float> SINGLE_PASS_OFFSETS = {0.0};
+
 
 uint DisplayObject::nextIndex = 0;
+uint DisplayObject::_generation = 0;
 std::map<uint, DisplayObject *> DisplayObject::indexMap;
 std::mutex DisplayObject::m;
 
@@ -69,8 +83,18 @@ void DisplayObject::initialize()
     createBuffer(normalBuffer);
     normalBuffer.allocate(&normalData[0], 3 * normalData.size() * sizeof(float));
 
+    // Quads are split into triangles, as GL_QUADS is not available in core profile contexts
+    std::vector<GLuint> triangleData(6 * faceData.size());
+    for (uint i = 0; i < faceData.size(); i++)
+    {
+        const quad &q = faceData[i];
+        GLuint *t = &triangleData[6*i];
+        t[0] = q.a; t[1] = q.b; t[2] = q.c;
+        t[3] = q.a; t[4] = q.c; t[5] = q.d;
+    }
+
     createBuffer(faceBuffer);
-    faceBuffer.allocate(&faceData[0], 4 * faceData.size() * sizeof(GLuint));
+    faceBuffer.allocate(&triangleData[0], triangleData.size() * sizeof(GLuint));
 
     createBuffer(elementBuffer);
     elementBuffer.allocate(&elementData[0], 2 * elementData.size() * sizeof(GLuint));
@@ -85,96 +109,131 @@ void DisplayObject::initialize()
 }
 
 
-void drawCommand(GLenum mode, const std::set<uint> &visible, int n, std::vector<uint> indices)
+void drawRange(GLenum mode, uint first, uint last, const std::vector<uint> &indices)
 {
-    uint mult = mode == GL_QUADS ? 4 : 2;
-    if (visible.size() == n)
-        glDrawElements(mode, mult*indices[n], GL_UNSIGNED_INT, 0);
-    else
-        for (auto i : visible)
-        {
-            glDrawElements(mode, mult*(indices[i+1] - indices[i]), GL_UNSIGNED_INT,
-                           (void *) (mult * indices[i] * sizeof(GLuint)));
-        }
+    uint mult = mode == GL_TRIANGLES ? 6 : 2;
+    glDrawElements(mode, mult*(indices[last] - indices[first]), GL_UNSIGNED_INT,
+                   (void *) (mult * indices[first] * sizeof(GLuint)));
 }
 
 
-void drawCommandPts(const std::set<uint> &visible, int n)
+// Runs of consecutive components are contiguous in the index buffers, so each run is drawn with
+// a single call
+void drawCommand(GLenum mode, const BitSet &visible, const std::vector<uint> &indices)
 {
-    if (visible.size() == n)
-        glDrawElements(GL_POINTS, n, GL_UNSIGNED_INT, 0);
-    else
-        for (auto i : visible)
-            glDrawElements(GL_POINTS, 1, GL_UNSIGNED_INT, (void *) (i * sizeof(GLuint)));
+    for (uint i = visible.next(0); i < visible.capacity(); )
+    {
+        uint j = i + 1;
+        while (visible.test(j))
+            j++;
+
+        drawRange(mode, i, j, indices);
+        i = visible.next(j);
+    }
 }
 
 
-void sortSelection(const std::set<uint> &selected, const std::set<uint> &visible,
-                   std::set<uint> &outSel, std::set<uint> &outUnsel)
+void drawCommandPts(const BitSet &visible)
 {
-    outSel.clear();
-    outUnsel.clear();
+    for (uint i = visible.next(0); i < visible.capacity(); )
+    {
+        uint j = i + 1;
+        while (visible.test(j))
+            j++;
 
-    for (auto f : visible)
-        if (selected.find(f) != selected.end())
-            outSel.insert(f);
-        else
-            outUnsel.insert(f);
+        glDrawElements(GL_POINTS, j - i, GL_UNSIGNED_INT, (void *) (i * sizeof(GLuint)));
+        i = visible.next(j);
+    }
 }
 
 
-void DisplayObject::draw(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, bool showPoints)
+// In single pass mode the faces are pushed back in depth with glPolygonOffset instead, so
+// lines and edges are drawn once, exactly on the surface, and remain visible from both sides.
+const std::vector<float> &passOffsets(const std::vector<float> &offsets, bool singlePass)
+{
+    return (singlePass && !offsets.empty()) ? SINGLE_PASS_OFFSETS : offsets;
+}
+
+
+void sortSelection(const BitSet &selected, const BitSet &visible, BitSet &outSel, BitSet &outUnsel)
+{
+    outSel = visible;
+    outSel.intersect(selected);
+
+    outUnsel = visible;
+    outUnsel.erase(selected);
+}
+
+
+void DisplayObject::draw(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+                         bool showPoints, bool singlePass, bool exteriorOnly)
 {
     if (!_initialized)
         return;
 
-    std::set<uint> sel, unsel;
-
-    prog.bind();
+    BitSet sel, unsel;
 
-    bindBuffer(prog, vertexBuffer, "vertexPosition");
-    bindBuffer(prog, normalBuffer, "vertexNormal");
+    bindProgram(prog);
 
 
     faceBuffer.bind();
     sortSelection(selectedFaces, visibleFaces, sel, unsel);
 
-    for (auto off : faceOffsets)
+    if (exteriorOnly)
+    {
+        sel.erase(interiorFaces);
+        unsel.erase(interiorFaces);
+    }
+
+    if (singlePass)
+    {
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(POLYGON_OFFSET_FACTOR, POLYGON_OFFSET_UNITS);
+    }
+
+    for (auto off : passOffsets(faceOffsets, singlePass))
     {
         setUniforms(prog, mvp, FACE_COLOR_SELECTED, off);
-        drawCommand(GL_QUADS, sel, nFaces(), faceIdxs);
+        drawCommand(GL_TRIANGLES, sel, faceIdxs);
         setUniforms(prog, mvp, FACE_COLOR_NORMAL, off);
-        drawCommand(GL_QUADS, unsel, nFaces(), faceIdxs);
+        drawCommand(GL_TRIANGLES, unsel, faceIdxs);
     }
 
+    if (singlePass)
+        glDisable(GL_POLYGON_OFFSET_FILL);
+
+
+    bindProgram(lineProg);
 
     elementBuffer.bind();
-    glLineWidth(LINE_WIDTH);
+    setLineWidth(lineProg, LINE_WIDTH);
 
-    for (auto off : lineOffsets)
+    for (auto off : passOffsets(lineOffsets, singlePass))
     {
-        setUniforms(prog, mvp, LINE_COLOR_SELECTED, off);
-        drawCommand(GL_LINES, sel, nFaces(), elementIdxs);
-        setUniforms(prog, mvp, LINE_COLOR_NORMAL, off);
-        drawCommand(GL_LINES, unsel, nFaces(), elementIdxs);
+        setUniforms(lineProg, mvp, LINE_COLOR_SELECTED, off);
+        drawCommand(GL_LINES, sel, elementIdxs);
+        setUniforms(lineProg, mvp, LINE_COLOR_NORMAL, off);
+        drawCommand(GL_LINES, unsel, elementIdxs);
     }
 
 
     edgeBuffer.bind();
     sortSelection(selectedEdges, visibleEdges, sel, unsel);
-    glLineWidth(EDGE_WIDTH);
+    setLineWidth(lineProg, EDGE_WIDTH);
 
-    for (auto off : edgeOffsets)
+    for (auto off : passOffsets(edgeOffsets, singlePass))
     {
-        setUniforms(prog, mvp, EDGE_COLOR_SELECTED, off);
-        drawCommand(GL_LINES, sel, nEdges(), edgeIdxs);
-        setUniforms(prog, mvp, EDGE_COLOR_NORMAL, off);
-        drawCommand(GL_LINES, unsel, nEdges(), edgeIdxs);
+        setUniforms(lineProg, mvp, EDGE_COLOR_SELECTED, off);
+        drawCommand(GL_LINES, sel, edgeIdxs);
+        setUniforms(lineProg, mvp, EDGE_COLOR_NORMAL, off);
+        drawCommand(GL_LINES, unsel, edgeIdxs);
     }
 
 
     if (showPoints)
     {
+        bindProgram(prog);
+
         pointBuffer.bind();
         sortSelection(selectedPoints, visiblePoints, sel, unsel);
         glPointSize(POINT_SIZE);
@@ -182,25 +241,33 @@ void DisplayObject::draw(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, bool showP
         for (auto off : pointOffsets)
         {
             setUniforms(prog, mvp, POINT_COLOR_SELECTED, off);
-            drawCommandPts(sel, nPoints());
+            drawCommandPts(sel);
             setUniforms(prog, mvp, POINT_COLOR_NORMAL, off);
-            drawCommandPts(unsel, nPoints());
+            drawCommandPts(unsel);
         }
     }
 }
 
 
-void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, SelectionMode mode)
+void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+                                SelectionMode mode, bool exteriorOnly)
 {
     if (!_initialized)
         return;
 
-    uint offset = 0;
+    // Hidden interior faces neither get picked nor hide anything
+    BitSet exterior;
+    const BitSet *faces = &visibleFaces;
+    if (exteriorOnly)
+    {
+        exterior = visibleFaces;
+        exterior.erase(interiorFaces);
+        faces = &exterior;
+    }
 
-    prog.bind();
+    uint offset = 0;
 
-    bindBuffer(prog, vertexBuffer, "vertexPosition");
-    bindBuffer(prog, normalBuffer, "vertexNormal");
+    bindProgram(prog);
 
 
     faceBuffer.bind();
@@ -209,17 +276,18 @@ void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, Sel
         if (nFaces() > 0)
             for (auto off : faceOffsets)
             {
-                setUniforms(prog, mvp, indexToColor(_index, offset), off);
-                drawCommand(GL_QUADS, visibleFaces, nFaces(), faceIdxs);
+                setPickUniforms(prog, mvp, indexToKey(_index), offset, off);
+                drawCommand(GL_TRIANGLES, *faces, faceIdxs);
             }
         else
         {
+            bindProgram(lineProg);
             edgeBuffer.bind();
-            glLineWidth(20 * EDGE_WIDTH);
+            setLineWidth(lineProg, 20 * EDGE_WIDTH);
             for (auto off : edgeOffsets)
             {
-                setUniforms(prog, mvp, indexToColor(_index, offset), off);
-                drawCommand(GL_LINES, visibleEdges, nEdges(), edgeIdxs);
+                setPickUniforms(lineProg, mvp, indexToKey(_index), offset, off);
+                drawCommand(GL_LINES, visibleEdges, edgeIdxs);
             }
         }
     }
@@ -227,11 +295,11 @@ void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, Sel
     {
         for (uint f = 0; f < nFaces(); f++)
         {
-            if (visibleFaces.find(f) != visibleFaces.end())
+            if (faces->test(f))
                 for (auto off : faceOffsets)
                 {
-                    setUniforms(prog, mvp, indexToColor(_index, offset), off);
-                    drawCommand(GL_QUADS, {f}, nFaces(), faceIdxs);
+                    setPickUniforms(prog, mvp, indexToKey(_index), offset, off);
+                    drawRange(GL_TRIANGLES, f, f + 1, faceIdxs);
                 }
             offset++;
         }
@@ -240,19 +308,20 @@ void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, Sel
     {
         if (nFaces() > 0)
         {
-            setUniforms(prog, mvp, WHITE, 0.0);
-            drawCommand(GL_QUADS, visibleFaces, nFaces(), faceIdxs);
+            setPickUniforms(prog, mvp, BACKGROUND_KEY, 0, 0.0);
+            drawCommand(GL_TRIANGLES, *faces, faceIdxs);
         }
 
+        bindProgram(lineProg);
         edgeBuffer.bind();
-        glLineWidth(20 * EDGE_WIDTH);
+        setLineWidth(lineProg, 20 * EDGE_WIDTH);
         for (uint e = 0; e < nEdges(); e++)
         {
-            if (visibleEdges.find(e) != visibleEdges.end())
+            if (visibleEdges.test(e))
                 for (auto off : edgeOffsets)
                 {
-                    setUniforms(prog, mvp, indexToColor(_index, offset), off);
-                    drawCommand(GL_LINES, {e}, nEdges(), edgeIdxs);
+                    setPickUniforms(lineProg, mvp, indexToKey(_index), offset, off);
+                    drawRange(GL_LINES, e, e + 1, edgeIdxs);
                 }
             offset++;
         }
@@ -261,19 +330,19 @@ void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, Sel
     {
         if (nFaces() > 0)
         {
-            setUniforms(prog, mvp, WHITE, 0.0);
-            drawCommand(GL_QUADS, visibleFaces, nFaces(), faceIdxs);
+            setPickUniforms(prog, mvp, BACKGROUND_KEY, 0, 0.0);
+            drawCommand(GL_TRIANGLES, *faces, faceIdxs);
         }
 
         pointBuffer.bind();
         glPointSize(POINT_SIZE);
         for (uint p = 0; p < nPoints(); p++)
         {
-            if (visiblePoints.find(p) != visiblePoints.end())
+            if (visiblePoints.test(p))
                 for (auto off : pointOffsets)
                 {
-                    setUniforms(prog, mvp, indexToColor(_index, offset), off);
-                    drawCommandPts({p}, nPoints());
+                    setPickUniforms(prog, mvp, indexToKey(_index), offset, off);
+                    glDrawElements(GL_POINTS, 1, GL_UNSIGNED_INT, (void *) (p * sizeof(GLuint)));
                 }
             offset++;
         }
@@ -281,6 +350,110 @@ void DisplayObject::drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, Sel
 }
 
 
+void DisplayObject::drawHover(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+                              SelectionMode mode, uint component)
+{
+    if (!_initialized)
+        return;
+
+    uint n = mode == SM_FACE ? nFaces() : (mode == SM_EDGE ? nEdges() : (mode == SM_POINT ? nPoints() : 1));
+    if (component >= n)
+        return;
+
+    bindProgram(prog);
+
+
+    if (mode == SM_FACE || (mode == SM_PATCH && nFaces() > 0))
+    {
+        // Pulled towards the viewer to win the depth test against the same faces in the scene
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(-POLYGON_OFFSET_FACTOR, -POLYGON_OFFSET_UNITS);
+
+        faceBuffer.bind();
+        for (auto off : faceOffsets)
+        {
+            setUniforms(prog, mvp, FACE_COLOR_HOVER, off);
+            if (mode == SM_FACE)
+                drawRange(GL_TRIANGLES, component, component + 1, faceIdxs);
+            else
+                drawCommand(GL_TRIANGLES, visibleFaces, faceIdxs);
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+    else if (mode == SM_EDGE || mode == SM_PATCH)
+    {
+        bindProgram(lineProg);
+        edgeBuffer.bind();
+        setLineWidth(lineProg, 2 * EDGE_WIDTH);
+        for (auto off : edgeOffsets)
+        {
+            setUniforms(lineProg, mvp, EDGE_COLOR_HOVER, off);
+            if (mode == SM_EDGE)
+                drawRange(GL_LINES, component, component + 1, edgeIdxs);
+            else
+                drawCommand(GL_LINES, visibleEdges, edgeIdxs);
+        }
+    }
+    else if (mode == SM_POINT)
+    {
+        pointBuffer.bind();
+        glPointSize(POINT_SIZE);
+        for (auto off : pointOffsets)
+        {
+            setUniforms(prog, mvp, POINT_COLOR_HOVER, off);
+            glDrawElements(GL_POINTS, 1, GL_UNSIGNED_INT, (void *) (component * sizeof(GLuint)));
+        }
+    }
+}
+
+
+void DisplayObject::initSets()
+{
+    visibleFaces = BitSet(nFaces(), true);
+    visibleEdges = BitSet(nEdges(), true);
+    visiblePoints = BitSet(nPoints(), true);
+
+    selectedFaces = BitSet(nFaces());
+    selectedEdges = BitSet(nEdges());
+    selectedPoints = BitSet(nPoints());
+
+    interiorFaces = BitSet(nFaces());
+}
+
+
+void DisplayObject::mkAdjacency()
+{
+    edgeFaceIdxs.assign(nEdges() + 1, 0);
+    for (auto &q : faceEdges)
+        for (auto e : {q.a, q.b, q.c, q.d})
+            edgeFaceIdxs[e+1]++;
+    std::partial_sum(edgeFaceIdxs.begin(), edgeFaceIdxs.end(), edgeFaceIdxs.begin());
+
+    std::vector<uint> next(edgeFaceIdxs.begin(), edgeFaceIdxs.end() - 1);
+    edgeFaceData.resize(edgeFaceIdxs.back());
+    for (uint f = 0; f < faceEdges.size(); f++)
+        for (auto e : {faceEdges[f].a, faceEdges[f].b, faceEdges[f].c, faceEdges[f].d})
+            edgeFaceData[next[e]++] = f;
+
+    pointEdgeIdxs.assign(nPoints() + 1, 0);
+    for (auto &s : edgePoints)
+    {
+        pointEdgeIdxs[s.a+1]++;
+        pointEdgeIdxs[s.b+1]++;
+    }
+    std::partial_sum(pointEdgeIdxs.begin(), pointEdgeIdxs.end(), pointEdgeIdxs.begin());
+
+    next.assign(pointEdgeIdxs.begin(), pointEdgeIdxs.end() - 1);
+    pointEdgeData.resize(pointEdgeIdxs.back());
+    for (uint e = 0; e < edgePoints.size(); e++)
+    {
+        pointEdgeData[next[edgePoints[e].a]++] = e;
+        pointEdgeData[next[edgePoints[e].b]++] = e;
+    }
+}
+
+
 void DisplayObject::computeBoundingSphere()
 {
     QVector3D point = vertexData[0], found;
@@ -295,6 +468,20 @@ void DisplayObject::computeBoundingSphere()
 }
 
 
+void DisplayObject::computeBoundingBox()
+{
+    _boxMin = _boxMax = vertexData[0];
+
+    for (auto p : vertexData)
+    {
+        _boxMin = QVector3D(std::min(_boxMin.x(), p.x()), std::min(_boxMin.y(), p.y()),
+                            std::min(_boxMin.z(), p.z()));
+        _boxMax = QVector3D(std::max(_boxMax.x(), p.x()), std::max(_boxMax.y(), p.y()),
+                            std::max(_boxMax.z(), p.z()));
+    }
+}
+
+
 void DisplayObject::farthestPointFrom(QVector3D point, QVector3D *found)
 {
     float distance = -1;
@@ -375,26 +562,20 @@ void DisplayObject::selectObject(SelectionMode mode, bool selected)
         {
             if (nFaces() > 0)
             {
-                for (int i = 0; i < nFaces(); i++)
-                    selectedFaces.insert(i);
+                selectedFaces.fill();
                 refreshEdgesFromFaces();
             }
             else
-                for (int i = 0; i < nEdges(); i++)
-                    selectedEdges.insert(i);
+                selectedEdges.fill();
             refreshPointsFromEdges();
         }
         else if (mode == SM_EDGE)
         {
-            for (int i = 0; i < nEdges(); i++)
-                selectedEdges.insert(i);
+            selectedEdges.fill();
             refreshPointsFromEdges();
         }
         else if (mode == SM_POINT)
-        {
-            for (int i = 0; i < nPoints(); i++)
-                selectedPoints.insert(i);
-        }
+            selectedPoints.fill();
     }
     else
     {
@@ -405,77 +586,113 @@ void DisplayObject::selectObject(SelectionMode mode, bool selected)
 }
 
 
-void DisplayObject::selectFaces(bool selected, std::set<uint> faces)
+void DisplayObject::selectFaces(bool selected, const std::vector<uint> &faces)
 {
-    if (!selected)
+    if (selected)
     {
         for (auto f : faces)
-            selectedFaces.erase(f);
-        refreshEdgesFromFaces();
-        refreshPointsFromEdges();
+        {
+            selectedFaces.insert(f);
+            for (auto e : {faceEdges[f].a, faceEdges[f].b, faceEdges[f].c, faceEdges[f].d})
+            {
+                selectedEdges.insert(e);
+                selectedPoints.insert(edgePoints[e].a);
+                selectedPoints.insert(edgePoints[e].b);
+            }
+        }
 
         return;
     }
 
-    selectedFaces.insert(faces.begin(), faces.end());
+    // Only the edges and points of the deselected faces can lose their last selected neighbour
+    for (auto f : faces)
+        selectedFaces.erase(f);
 
-    std::set<uint> edges;
+    std::vector<uint> edges;
     for (auto f : faces)
-    {
-        edges.insert(faceEdgeMap[f].a);
-        edges.insert(faceEdgeMap[f].b);
-        edges.insert(faceEdgeMap[f].c);
-        edges.insert(faceEdgeMap[f].d);
-    }
+        for (auto e : {faceEdges[f].a, faceEdges[f].b, faceEdges[f].c, faceEdges[f].d})
+            if (!edgeHasSelectedFace(e))
+                edges.push_back(e);
 
-    selectEdges(true, edges);
+    selectEdges(false, edges);
 }
 
 
-void DisplayObject::selectEdges(bool selected, std::set<uint> edges)
+void DisplayObject::selectEdges(bool selected, const std::vector<uint> &edges)
 {
-    if (!selected)
+    if (selected)
     {
         for (auto e : edges)
-            selectedEdges.erase(e);
-        refreshPointsFromEdges();
+        {
+            selectedEdges.insert(e);
+            selectedPoints.insert(edgePoints[e].a);
+            selectedPoints.insert(edgePoints[e].b);
+        }
 
         return;
     }
 
-    selectedEdges.insert(edges.begin(), edges.end());
-
-    std::set<uint> points;
     for (auto e : edges)
-    {
-        points.insert(edgePointMap[e].a);
-        points.insert(edgePointMap[e].b);
-    }
+        selectedEdges.erase(e);
 
-    selectPoints(true, points);
+    for (auto e : edges)
+        for (auto p : {edgePoints[e].a, edgePoints[e].b})
+            if (!pointHasSelectedEdge(p))
+                selectedPoints.erase(p);
 }
 
 
-void DisplayObject::selectPoints(bool selected, std::set<uint> points)
+void DisplayObject::selectPoints(bool selected, const std::vector<uint> &points)
 {
-    if (selected)
-        selectedPoints.insert(points.begin(), points.end());
-    else
-        for (auto p : points)
+    for (auto p : points)
+        if (selected)
+            selectedPoints.insert(p);
+        else
             selectedPoints.erase(p);
 }
 
 
+void DisplayObject::invertSelection(SelectionMode mode)
+{
+    // Only visible components are selected by inversion
+    switch (mode)
+    {
+    case SM_PATCH:
+        selectObject(mode, !hasSelection() &&
+                     (!visibleFaces.empty() || !visibleEdges.empty() || !visiblePoints.empty()));
+        break;
+
+    case SM_FACE:
+        selectedFaces.invert();
+        selectedFaces.intersect(visibleFaces);
+        refreshEdgesFromFaces();
+        refreshPointsFromEdges();
+        break;
+
+    case SM_EDGE:
+        selectedEdges.invert();
+        selectedEdges.intersect(visibleEdges);
+        refreshPointsFromEdges();
+        break;
+
+    case SM_POINT:
+        selectedPoints.invert();
+        selectedPoints.intersect(visiblePoints);
+        break;
+    }
+}
+
+
 bool DisplayObject::fullSelection(SelectionMode mode)
 {
     if (mode == SM_PATCH)
         return hasSelection();
     else if (mode == SM_FACE)
-        return selectedFaces.size() == nFaces();
+        return selectedFaces.full();
     else if (mode == SM_EDGE)
-        return selectedEdges.size() == nEdges();
+        return selectedEdges.full();
     else if (mode == SM_POINT)
-        return selectedPoints.size() == nPoints();
+        return selectedPoints.full();
 }
 
 
@@ -485,78 +702,192 @@ void DisplayObject::showSelected(SelectionMode mode, bool visible)
     {
         if (!visible)
         {
-            visibleFaces = {};
-            visibleEdges = {};
-            visiblePoints = {};
+            visibleFaces.clear();
+            visibleEdges.clear();
+            visiblePoints.clear();
         }
         else
         {
-            for (int i = 0; i < nFaces(); i++)
-                visibleFaces.insert(i);
-            for (int i = 0; i < nEdges(); i++)
-                visibleEdges.insert(i);
-            for (int i = 0; i < nPoints(); i++)
-                visiblePoints.insert(i);
+            visibleFaces.fill();
+            visibleEdges.fill();
+            visiblePoints.fill();
         }
     }
     else if (mode == SM_FACE)
     {
         if (!visible)
-            for (auto f : selectedFaces)
-                visibleFaces.erase(f);
+            visibleFaces.erase(selectedFaces);
         else
-            visibleFaces.insert(selectedFaces.begin(), selectedFaces.end());
+            visibleFaces.insert(selectedFaces);
     }
     else if (mode == SM_EDGE)
     {
         if (!visible)
-            for (auto f : selectedEdges)
-                visibleEdges.erase(f);
+            visibleEdges.erase(selectedEdges);
         else
-            visibleEdges.insert(selectedEdges.begin(), selectedEdges.end());
+            visibleEdges.insert(selectedEdges);
     }
     else if (mode == SM_POINT)
     {
         if (!visible)
-            for (auto f : selectedPoints)
-                visiblePoints.erase(f);
+            visiblePoints.erase(selectedPoints);
         else
-            visiblePoints.insert(selectedPoints.begin(), selectedPoints.end());
+            visiblePoints.insert(selectedPoints);
+    }
+}
+
+
+DisplayObject::state DisplayObject::saveState()
+{
+    state s;
+    for (auto set : stateSets())
+        s.push_back(*set);
+    return s;
+}
+
+
+bool DisplayObject::diffState(const state &before, delta *d)
+{
+    std::vector<BitSet *> sets = stateSets();
+
+    bool changed = false;
+    d->resize(sets.size());
+    for (uint i = 0; i < sets.size(); i++)
+    {
+        (*d)[i] = sets[i]->diff(before[i]);
+        changed |= !(*d)[i].empty();
     }
+
+    return changed;
+}
+
+
+void DisplayObject::toggleState(const delta &d)
+{
+    std::vector<BitSet *> sets = stateSets();
+    for (uint i = 0; i < sets.size(); i++)
+        sets[i]->toggle(d[i]);
+}
+
+
+std::vector<BitSet *> DisplayObject::stateSets()
+{
+    return {&selectedFaces, &selectedEdges, &selectedPoints, &visibleFaces, &visibleEdges, &visiblePoints};
+}
+
+
+QVector3D DisplayObject::faceCentroid(uint f)
+{
+    QVector3D sum(0,0,0);
+    for (uint i = faceIdxs[f]; i < faceIdxs[f+1]; i++)
+        sum += vertexData[faceData[i].a] + vertexData[faceData[i].b] +
+               vertexData[faceData[i].c] + vertexData[faceData[i].d];
+
+    return sum / (4 * (faceIdxs[f+1] - faceIdxs[f]));
+}
+
+
+QVector3D DisplayObject::edgeCentroid(uint e)
+{
+    QVector3D sum(0,0,0);
+    for (uint i = edgeIdxs[e]; i < edgeIdxs[e+1]; i++)
+        sum += vertexData[edgeData[i].a] + vertexData[edgeData[i].b];
+
+    return sum / (2 * (edgeIdxs[e+1] - edgeIdxs[e]));
+}
+
+
+uint DisplayObject::faceOf(uint q)
+{
+    return std::upper_bound(faceIdxs.begin(), faceIdxs.end(), q) - faceIdxs.begin() - 1;
+}
+
+
+uint DisplayObject::edgeOf(uint s)
+{
+    return std::upper_bound(edgeIdxs.begin(), edgeIdxs.end(), s) - edgeIdxs.begin() - 1;
+}
+
+
+BVH &DisplayObject::faceBVH()
+{
+    if (!faceTree.built())
+    {
+        std::vector<box> boxes;
+        boxes.reserve(faceData.size());
+        for (auto &q : faceData)
+        {
+            box b = {vertexData[q.a], vertexData[q.a]};
+            for (auto v : {q.b, q.c, q.d})
+                for (int k = 0; k < 3; k++)
+                {
+                    b.lo[k] = std::min(b.lo[k], vertexData[v][k]);
+                    b.hi[k] = std::max(b.hi[k], vertexData[v][k]);
+                }
+            boxes.push_back(b);
+        }
+        faceTree.build(boxes);
+    }
+
+    return faceTree;
+}
+
+
+BVH &DisplayObject::edgeBVH()
+{
+    if (!edgeTree.built())
+    {
+        std::vector<box> boxes;
+        boxes.reserve(edgeData.size());
+        for (auto &e : edgeData)
+        {
+            box b = {vertexData[e.a], vertexData[e.a]};
+            for (int k = 0; k < 3; k++)
+            {
+                b.lo[k] = std::min(b.lo[k], vertexData[e.b][k]);
+                b.hi[k] = std::max(b.hi[k], vertexData[e.b][k]);
+            }
+            boxes.push_back(b);
+        }
+        edgeTree.build(boxes);
+    }
+
+    return edgeTree;
 }
 
 
 void DisplayObject::refreshEdgesFromFaces()
 {
     selectedEdges.clear();
-    for (auto e : selectedFaces)
-        selectEdges(true, {faceEdgeMap[e].a, faceEdgeMap[e].b, faceEdgeMap[e].c, faceEdgeMap[e].d});
+    for (uint e = 0; e < nEdges(); e++)
+        if (edgeHasSelectedFace(e))
+            selectedEdges.insert(e);
 }
 
 
 void DisplayObject::refreshPointsFromEdges()
 {
     selectedPoints.clear();
-    for (auto e : selectedEdges)
-        selectPoints(true, {edgePointMap[e].a, edgePointMap[e].b});
+    for (uint p = 0; p < nPoints(); p++)
+        if (pointHasSelectedEdge(p))
+            selectedPoints.insert(p);
 }
 
 
 void DisplayObject::balloonEdgesToFaces(bool conjunction)
 {
-    std::set<uint> faces;
+    std::vector<uint> faces;
     for (uint f = 0; f < nFaces(); f++)
-        if ((conjunction &&  (selectedEdges.find(faceEdgeMap[f].a) != selectedEdges.end() &&
-                              selectedEdges.find(faceEdgeMap[f].b) != selectedEdges.end() &&
-                              selectedEdges.find(faceEdgeMap[f].c) != selectedEdges.end() &&
-                              selectedEdges.find(faceEdgeMap[f].d) != selectedEdges.end())) ||
-            (!conjunction && (selectedEdges.find(faceEdgeMap[f].a) != selectedEdges.end() ||
-                              selectedEdges.find(faceEdgeMap[f].b) != selectedEdges.end() ||
-                              selectedEdges.find(faceEdgeMap[f].c) != selectedEdges.end() ||
-                              selectedEdges.find(faceEdgeMap[f].d) != selectedEdges.end())))
+    {
+        const quad &q = faceEdges[f];
+        if ((conjunction &&  (selectedEdges.test(q.a) && selectedEdges.test(q.b) &&
+                              selectedEdges.test(q.c) && selectedEdges.test(q.d))) ||
+            (!conjunction && (selectedEdges.test(q.a) || selectedEdges.test(q.b) ||
+                              selectedEdges.test(q.c) || selectedEdges.test(q.d))))
         {
-            faces.insert(f);
+            faces.push_back(f);
         }
+    }
 
     selectFaces(true, faces);
 }
@@ -564,20 +895,39 @@ void DisplayObject::balloonEdgesToFaces(bool conjunction)
 
 void DisplayObject::balloonPointsToEdges(bool conjunction)
 {
-    std::set<uint> edges;
+    std::vector<uint> edges;
     for (uint e = 0; e < nEdges(); e++)
-        if ((conjunction &&  (selectedPoints.find(edgePointMap[e].a) != selectedPoints.end() &&
-                              selectedPoints.find(edgePointMap[e].b) != selectedPoints.end())) ||
-            (!conjunction && (selectedPoints.find(edgePointMap[e].a) != selectedPoints.end() ||
-                              selectedPoints.find(edgePointMap[e].b) != selectedPoints.end())))
+    {
+        const pair &s = edgePoints[e];
+        if ((conjunction &&  (selectedPoints.test(s.a) && selectedPoints.test(s.b))) ||
+            (!conjunction && (selectedPoints.test(s.a) || selectedPoints.test(s.b))))
         {
-            edges.insert(e);
+            edges.push_back(e);
         }
+    }
 
     selectEdges(true, edges);
 }
 
 
+bool DisplayObject::edgeHasSelectedFace(uint e)
+{
+    for (uint i = edgeFaceIdxs[e]; i < edgeFaceIdxs[e+1]; i++)
+        if (selectedFaces.test(edgeFaceData[i]))
+            return true;
+    return false;
+}
+
+
+bool DisplayObject::pointHasSelectedEdge(uint p)
+{
+    for (uint i = pointEdgeIdxs[p]; i < pointEdgeIdxs[p+1]; i++)
+        if (selectedEdges.test(pointEdgeData[i]))
+            return true;
+    return false;
+}
+
+
 void DisplayObject::createBuffer(QOpenGLBuffer &buffer)
 {
     buffer.create();
@@ -594,6 +944,32 @@ void DisplayObject::bindBuffer(QOpenGLShaderProgram &prog, QOpenGLBuffer &buffer
 }
 
 
+void DisplayObject::bindProgram(QOpenGLShaderProgram &prog)
+{
+    prog.bind();
+
+    bindBuffer(prog, vertexBuffer, "vertexPosition");
+    bindBuffer(prog, normalBuffer, "vertexNormal");
+}
+
+
+void DisplayObject::setLineWidth(QOpenGLShaderProgram &prog, float width)
+{
+    int location = prog.uniformLocation("lineWidth");
+    if (location < 0)
+    {
+        glLineWidth(width);
+        return;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    prog.setUniformValue(location, width);
+    prog.setUniformValue("viewport", QVector2D(viewport[2], viewport[3]));
+}
+
+
 void DisplayObject::setUniforms(QOpenGLShaderProgram &prog, QMatrix4x4 mvp, QVector3D col, float p)
 {
     prog.setUniformValue("mvp", mvp);
@@ -602,10 +978,12 @@ void DisplayObject::setUniforms(QOpenGLShaderProgram &prog, QMatrix4x4 mvp, QVec
 }
 
 
-void DisplayObject::setUniforms(QOpenGLShaderProgram &prog, QMatrix4x4 mvp, uchar *col, float p)
+void DisplayObject::setPickUniforms(QOpenGLShaderProgram &prog, QMatrix4x4 mvp, uint key, uint component,
+                                    float p)
 {
     prog.setUniformValue("mvp", mvp);
-    prog.setUniformValue("col", QVector3D((float) col[0]/255, (float) col[1]/255, (float) col[2]/255));
+    QOpenGLContext::currentContext()->extraFunctions()->glUniform2ui(prog.uniformLocation("key"),
+                                                                     key, component);
     prog.setUniformValue("p", p);
 }
 
@@ -624,6 +1002,7 @@ uint DisplayObject::registerObject(DisplayObject *obj)
         nextIndex = (nextIndex + 1) % NUM_INDICES;
 
     indexMap[nextIndex] = obj;
+    _generation++;
     return nextIndex;
 }
 
@@ -631,35 +1010,5 @@ uint DisplayObject::registerObject(DisplayObject *obj)
 void DisplayObject::deregisterObject(uint index)
 {
     indexMap.erase(index);
-}
-
-
-QVector3D DisplayObject::indexToColor(uint index, uint offset)
-{
-    uint i = COLORS_PER_OBJECT * index + offset;
-
-    uchar red = i % 256; i /= 256;
-    uchar green = i % 256; i /= 256;
-    uchar blue = i % 256;
-
-    return QVector3D((float) red/255, (float) green/255, (float) blue/255);
-}
-
-
-void DisplayObject::colorToIndex(GLubyte color[3], uint *index, uint *offset)
-{
-    keyToIndex(colorToKey(color), index, offset);
-}
-
-
-uint DisplayObject::colorToKey(GLubyte color[3])
-{
-    return color[2]*256*256 + color[1]*256 + color[0];
-}
-
-
-void DisplayObject::keyToIndex(uint key, uint *index, uint *offset)
-{
-    *index = key / COLORS_PER_OBJECT;
-    *offset = key % COLORS_PER_OBJECT;
+    _generation++;
 }
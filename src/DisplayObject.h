@@ -9,13 +9,16 @@
 #include <QMatrix4x4>
 #include <QVector3D>
 
+#include "BitSet.h"
+#include "BVH.h"
+
 #ifndef _DISPLAYOBJECT_H_
 #define _DISPLAYOBJECT_H_
 
-#define NUM_COLORS 16777216
-#define COLORS_PER_OBJECT 12
-#define NUM_INDICES (NUM_COLORS/COLORS_PER_OBJECT)
-#define WHITE_KEY (NUM_COLORS-1)
+// Picking writes (object key, component) pairs of 32-bit integers, where the object key is the
+// index plus one and zero is reserved for the background
+#define NUM_INDICES 0xffffffff
+#define BACKGROUND_KEY 0
 
 typedef unsigned char uchar;
 typedef unsigned short ushort;
@@ -38,24 +41,38 @@ public:
     inline bool initialized() { return _initialized; }
     void initialize();
 
-    void draw(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, bool showPoints);
-    void drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, SelectionMode mode);
+    // Lines are drawn with lineProg, which may be the same as prog. See setLineWidth.
+    void draw(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+              bool showPoints, bool singlePass, bool exteriorOnly);
+    void drawPicking(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+                     SelectionMode mode, bool exteriorOnly);
+    void drawHover(QMatrix4x4 &mvp, QOpenGLShaderProgram &prog, QOpenGLShaderProgram &lineProg,
+                   SelectionMode mode, uint component);
+
+    // Programs with a lineWidth uniform expand lines to quads in a geometry shader, as core
+    // profiles do not support wide lines. Others use glLineWidth.
+    static void setLineWidth(QOpenGLShaderProgram &prog, float width);
 
     inline QVector3D center() { return _center; };
     inline float radius() { return _radius; }
+    inline QVector3D boxMin() { return _boxMin; }
+    inline QVector3D boxMax() { return _boxMax; }
 
     virtual uint nFaces() = 0;
     virtual uint nEdges() = 0;
     virtual uint nPoints() = 0;
 
+    inline uint index() { return _index; }
+
     inline void setPatch(Patch *p) { _patch = p; }
     inline Patch *patch() { return _patch; }
 
     void selectionMode(SelectionMode mode, bool conjunction = true);
     void selectObject(SelectionMode mode, bool selected);
-    void selectFaces(bool selected, std::set<uint> faces);
-    void selectEdges(bool selected, std::set<uint> edges);
-    void selectPoints(bool selected, std::set<uint> points);
+    void selectFaces(bool selected, const std::vector<uint> &faces);
+    void selectEdges(bool selected, const std::vector<uint> &edges);
+    void selectPoints(bool selected, const std::vector<uint> &points);
+    void invertSelection(SelectionMode mode);
 
     inline bool hasSelection()
     {
@@ -69,45 +86,100 @@ public:
     }
     inline bool isFullyVisible(bool countPoints)
     {
-        return (visibleFaces.size() == nFaces() &&
-                visibleEdges.size() == nEdges() &&
-                (countPoints ? visiblePoints.size() == nPoints() : true));
+        return visibleFaces.full() && visibleEdges.full() && (countPoints ? visiblePoints.full() : true);
     }
 
-    inline bool faceSelected(uint i) { return selectedFaces.find(i) != selectedFaces.end(); }
-    inline bool edgeSelected(uint i) { return selectedEdges.find(i) != selectedEdges.end(); }
-    inline bool pointSelected(uint i) { return selectedPoints.find(i) != selectedPoints.end(); }
+    inline bool faceSelected(uint i) { return selectedFaces.test(i); }
+    inline bool edgeSelected(uint i) { return selectedEdges.test(i); }
+    inline bool pointSelected(uint i) { return selectedPoints.test(i); }
+    inline const BitSet &selected(SelectionMode mode)
+    {
+        return mode == SM_FACE ? selectedFaces : mode == SM_EDGE ? selectedEdges : selectedPoints;
+    }
 
     void showSelected(SelectionMode mode, bool visible);
 
+    // Selection and visibility, for undo and redo. Toggling the delta between a saved state and
+    // the current one restores the saved state, and toggling it again reapplies the change.
+    typedef std::vector<BitSet> state;
+    typedef std::vector<BitSet::delta> delta;
+    state saveState();
+    bool diffState(const state &before, delta *d);
+    void toggleState(const delta &d);
+
+    QVector3D faceCentroid(uint f);
+    QVector3D edgeCentroid(uint e);
+    inline QVector3D pointPosition(uint p) { return vertexData[pointData[p]]; }
+
+    inline const quad &edgesOfFace(uint f) { return faceEdges[f]; }
+    inline const pair &pointsOfEdge(uint e) { return edgePoints[e]; }
+
+    inline bool faceInterior(uint i) { return interiorFaces.test(i); }
+    inline void setFaceInterior(uint i, bool interior = true)
+    {
+        if (interior)
+            interiorFaces.insert(i);
+        else
+            interiorFaces.erase(i);
+    }
+    inline void clearInterior() { interiorFaces.clear(); }
+
+    inline const std::vector<QVector3D> &vertices() { return vertexData; }
+    inline const std::vector<QVector3D> &normals() { return normalData; }
+    inline const std::vector<quad> &faces() { return faceData; }
+    inline const std::vector<pair> &edges() { return edgeData; }
+    inline const std::vector<GLuint> &points() { return pointData; }
+
+    inline bool faceVisible(uint i) { return visibleFaces.test(i); }
+    inline bool edgeVisible(uint i) { return visibleEdges.test(i); }
+    inline bool pointVisible(uint i) { return visiblePoints.test(i); }
+
+    // Maps an entry in faces() or edges() to the face or edge it belongs to
+    uint faceOf(uint q);
+    uint edgeOf(uint s);
+
+    // The entries in faces() or edges() that belong to a face or edge, as [first, last)
+    inline std::pair<uint,uint> faceRange(uint f) { return std::make_pair(faceIdxs[f], faceIdxs[f+1]); }
+    inline std::pair<uint,uint> edgeRange(uint e) { return std::make_pair(edgeIdxs[e], edgeIdxs[e+1]); }
+
+    // Bounding volume hierarchies over faces() and edges(), built on first use
+    BVH &faceBVH();
+    BVH &edgeBVH();
+
     static std::mutex m;
 
     static DisplayObject *getObject(uint idx);
-    static uint colorToKey(GLubyte color[3]);
-    static void keyToIndex(uint key, uint *index, uint *offset);
-    static void colorToIndex(GLubyte color[3], uint *index, uint *offset);
+    static inline uint keyToIndex(uint key) { return key - 1; }
 
     typedef typename std::map<uint, DisplayObject *>::iterator iterator;
     static iterator begin() { return indexMap.begin(); }
     static iterator end() { return indexMap.end(); }
 
+    // Changes whenever an object is created or destroyed
+    static uint generation() { return _generation; }
+
 protected:
     QVector3D _center;
     float _radius;
+    QVector3D _boxMin, _boxMax;
 
     std::vector<QVector3D> vertexData, normalData;
     std::vector<quad> faceData;
     std::vector<pair> elementData, edgeData;
     std::vector<GLuint> pointData;
 
-    std::set<uint> visibleFaces, visibleEdges, visiblePoints;
+    BitSet visibleFaces, visibleEdges, visiblePoints;
     std::vector<uint> faceIdxs, elementIdxs, edgeIdxs;
     std::vector<float> faceOffsets, lineOffsets, edgeOffsets, pointOffsets;
 
-    std::unordered_map<uint, quad> faceEdgeMap;
-    std::unordered_map<uint, pair> edgePointMap;
+    // The edges of each face and the points of each edge
+    std::vector<quad> faceEdges;
+    std::vector<pair> edgePoints;
 
+    void initSets();
+    void mkAdjacency();
     void computeBoundingSphere();
+    void computeBoundingBox();
     void mkSamples(const std::vector<double> &knots, std::vector<double> &params, uint ref);
 
 private:
@@ -115,27 +187,40 @@ private:
     bool _initialized;
     Patch *_patch;
 
-    std::set<uint> selectedFaces, selectedEdges, selectedPoints;
+    BitSet selectedFaces, selectedEdges, selectedPoints;
+    BitSet interiorFaces;
+    BVH faceTree, edgeTree;
+
+    // Inverse adjacency in compressed row form: the faces of edge e are
+    // edgeFaceData[edgeFaceIdxs[e], edgeFaceIdxs[e+1]), and likewise for the edges of a point
+    std::vector<uint> edgeFaceIdxs, edgeFaceData, pointEdgeIdxs, pointEdgeData;
+
     QOpenGLBuffer vertexBuffer, normalBuffer, faceBuffer, elementBuffer, edgeBuffer, pointBuffer;
 
     void farthestPointFrom(QVector3D point, QVector3D *found);
     void ritterSphere();
 
+    std::vector<BitSet *> stateSets();
+
     void refreshEdgesFromFaces();
     void refreshPointsFromEdges();
     void balloonEdgesToFaces(bool conjunction);
     void balloonPointsToEdges(bool conjunction);
+    bool edgeHasSelectedFace(uint e);
+    bool pointHasSelectedEdge(uint p);
 
     static void createBuffer(QOpenGLBuffer &buffer);
     static void bindBuffer(QOpenGLShaderProgram &prog, QOpenGLBuffer &buffer, const char *attribute);
+    void bindProgram(QOpenGLShaderProgram &prog);
     static void setUniforms(QOpenGLShaderProgram&, QMatrix4x4, QVector3D, float);
-    static void setUniforms(QOpenGLShaderProgram&, QMatrix4x4, uchar *, float);
+    static void setPickUniforms(QOpenGLShaderProgram&, QMatrix4x4, uint, uint, float);
 
     static std::map<uint, DisplayObject *> indexMap;
     static uint nextIndex;
+    static uint _generation;
     static uint registerObject(DisplayObject *obj);
     static void deregisterObject(uint index);
-    static QVector3D indexToColor(uint index, uint offset);
+    static inline uint indexToKey(uint index) { return index + 1; }
 };
 
 #endif /* _DISPLAYOBJECT_H_ */
@@ -23,10 +23,8 @@ Curve::Curve(Go::SplineCurve *c)
     nPts = n + 1;
 
 
-    // Visibility
-    visibleFaces = {};
-    visibleEdges = {0};
-    visiblePoints = {0,1};
+    // Visibility and selection, everything visible
+    initSets();
 
 
     // Offsets
@@ -43,16 +41,18 @@ Curve::Curve(Go::SplineCurve *c)
 
 
     // Maps
-    faceEdgeMap = {};
-    edgePointMap = {{0, {0,1}}};
+    faceEdges = {};
+    edgePoints = {{0,1}};
+    mkAdjacency();
 
 
     // Make data
     mkData();
 
 
-    // Compute bounding sphere
+    // Compute bounding volumes
     computeBoundingSphere();
+    computeBoundingBox();
 }
 
 
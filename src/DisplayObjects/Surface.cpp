@@ -40,10 +40,8 @@ Surface::Surface(Go::SplineSurface *s)
     nElemLines = nU * (ntV-1) + nV * (ntU - 1);
 
 
-    // Visibility
-    visibleFaces  = {0};
-    visibleEdges  = {0,1,2,3};
-    visiblePoints = {0,1,2,3};
+    // Visibility and selection, everything visible
+    initSets();
 
 
     // Offsets
@@ -60,11 +58,12 @@ Surface::Surface(Go::SplineSurface *s)
 
 
     // Maps
-    faceEdgeMap  = {{0, {0,1,2,3}}};
-    edgePointMap = {{0, {0,1}},
-                    {1, {2,3}},
-                    {2, {0,2}},
-                    {3, {1,3}}};
+    faceEdges  = {{0,1,2,3}};
+    edgePoints = {{0,1},
+                  {2,3},
+                  {0,2},
+                  {1,3}};
+    mkAdjacency();
 
 
     // Make data
@@ -75,8 +74,9 @@ Surface::Surface(Go::SplineSurface *s)
     mkPointData();
 
 
-    // Compute bounding sphere
+    // Compute bounding volumes
     computeBoundingSphere();
+    computeBoundingBox();
 }
 
 
@@ -52,10 +52,8 @@ Volume::Volume(Go::SplineVolume *v)
     nElemLines = 2 * (nLinesUV + nLinesUW + nLinesVW);
 
 
-    // Visibility
-    visibleFaces  = {0,1,2,3,4,5};
-    visibleEdges  = {0,1,2,3,4,5,6,7,8,9,10,11};
-    visiblePoints = {0,1,2,3,4,5,6,7};
+    // Visibility and selection, everything visible
+    initSets();
 
 
     // Offsets
@@ -75,24 +73,25 @@ Volume::Volume(Go::SplineVolume *v)
 
 
     // Maps
-    faceEdgeMap  = {{0, {0,1,4,5}},
-                    {1, {2,3,6,7}},
-                    {2, {0,2,8,9}},
-                    {3, {1,3,10,11}},
-                    {4, {4,6,8,10}},
-                    {5, {5,7,9,11}}};
-    edgePointMap = {{0, {0,1}},
-                    {1, {2,3}},
-                    {2, {4,5}},
-                    {3, {6,7}},
-                    {4, {0,2}},
-                    {5, {1,3}},
-                    {6, {4,6}},
-                    {7, {5,7}},
-                    {8, {0,4}},
-                    {9, {1,5}},
-                    {10, {2,6}},
-                    {11, {3,7}}};
+    faceEdges  = {{0,1,4,5},
+                  {2,3,6,7},
+                  {0,2,8,9},
+                  {1,3,10,11},
+                  {4,6,8,10},
+                  {5,7,9,11}};
+    edgePoints = {{0,1},
+                  {2,3},
+                  {4,5},
+                  {6,7},
+                  {0,2},
+                  {1,3},
+                  {4,6},
+                  {5,7},
+                  {0,4},
+                  {1,5},
+                  {2,6},
+                  {3,7}};
+    mkAdjacency();
 
 
     // Make data
@@ -103,8 +102,9 @@ Volume::Volume(Go::SplineVolume *v)
     mkPointData();
 
 
-    // Compute bounding sphere
+    // Compute bounding volumes
     computeBoundingSphere();
+    computeBoundingBox();
 }
 
 
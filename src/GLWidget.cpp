@@ -1,22 +1,49 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <set>
 #include <QFile>
 #include <QTextStream>
 #include <QRect>
+#include <QCursor>
 #include <QDesktopWidget>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "DisplayObject.h"
 
 #include "GLWidget.h"
+#include "Picker.h"
+
+
+#define PROXY_PADDING 0.01
+#define PICK_TILE_PIXELS (1 << 18)
+#define LASSO_SPACING 3
+#define LASSO_SNAP 6
+
 
 GLWidget::GLWidget(ObjectSet *oSet, QWidget *parent)
-    : QGLWidget(parent)
-    , vcProgram(), ccProgram()
+    : QOpenGLWidget(parent)
+    , core(false)
+    , vcProgram(), ccProgram(), pickProgram(), ccLineProgram(), pickLineProgram()
     , auxBuffer(QOpenGLBuffer::VertexBuffer)
     , axesBuffer(QOpenGLBuffer::IndexBuffer)
     , selectionBuffer(QOpenGLBuffer::IndexBuffer)
     , auxCBuffer(QOpenGLBuffer::VertexBuffer)
+    , boxBuffer(QOpenGLBuffer::VertexBuffer)
+    , boxIdxBuffer(QOpenGLBuffer::IndexBuffer)
+    , lassoBuffer(QOpenGLBuffer::VertexBuffer)
+    , sceneCache(NULL)
+    , sceneDirty(true)
+    , proxiesPending(false)
+    , pickFbo(0)
+    , pickColor(0)
+    , pickDepth(0)
+    , pickPbo {0, 0}
+    , pickPboSize(0)
+    , pickDirty(true)
     , objectSet(oSet)
     , shiftPressed(false)
     , ctrlPressed(false)
@@ -33,20 +60,46 @@ GLWidget::GLWidget(ObjectSet *oSet, QWidget *parent)
     , _rightHanded(true)
     , _showAxes(true)
     , _showPoints(false)
+    , _singlePassLines(false)
+    , _exteriorOnly(false)
+    , _occlusionCulling(true)
+    , _cpuPicking(false)
     , _diameter(20.0)
     , selectTracking(false)
+    , _selectionTool(SELECT_RECTANGLE)
+    , lassoTracking(false)
+    , hoverPending(false)
+    , hovering(false)
+    , hoverMode(SM_PATCH)
     , cameraTracking(false)
 {
     installEventFilter(parent);
     setFocusPolicy(Qt::ClickFocus);
+    setMouseTracking(true);
     QObject::connect(oSet, &ObjectSet::requestInitialization, this, &GLWidget::initializeDispObject);
-    QObject::connect(oSet, SIGNAL(update()), this, SLOT(update()));
-    QObject::connect(oSet, SIGNAL(selectionChanged()), this, SLOT(update()));
+    QObject::connect(oSet, SIGNAL(update()), this, SLOT(invalidate()));
+    QObject::connect(oSet, SIGNAL(selectionChanged()), this, SLOT(invalidateScene()));
+    QObject::connect(oSet, SIGNAL(selectionModeChanged(SelectionMode)), this, SLOT(resetHover()));
+    QObject::connect(oSet, SIGNAL(rowsRemoved(const QModelIndex &, int, int)), this, SLOT(resetHover()));
 }
 
 
 GLWidget::~GLWidget()
 {
+    makeCurrent();
+    for (auto &o : occlusion)
+        glDeleteQueries(1, &o.second.query);
+    if (pickFbo)
+    {
+        glDeleteFramebuffers(1, &pickFbo);
+        glDeleteRenderbuffers(1, &pickColor);
+        glDeleteRenderbuffers(1, &pickDepth);
+    }
+    if (pickPbo[0])
+        glDeleteBuffers(2, pickPbo);
+    delete sceneCache;
+    vao.destroy();
+    doneCurrent();
 }
 
 
@@ -76,16 +129,46 @@ void GLWidget::centerOnSelected()
         setZoom(1.0);
     }
 
-    update();
+    invalidate();
 }
 
 
-std::set<std::pair<uint,uint>> GLWidget::paintGLPicks(int x, int y, int w, int h)
+void GLWidget::paintPickBuffer()
 {
-    glClearColor(1.0, 1.0, 1.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    QOpenGLVertexArrayObject::Binder binder(&vao);
+
+    if (!pickFbo)
+    {
+        glGenFramebuffers(1, &pickFbo);
+        glGenRenderbuffers(1, &pickColor);
+        glGenRenderbuffers(1, &pickDepth);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pickFbo);
+
+    if (pickSize != size())
+    {
+        glBindRenderbuffer(GL_RENDERBUFFER, pickColor);
+        // Integer formats are never blended, and the buffer is single-sampled, so keys are
+        // always written exactly
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32UI, width(), height());
+        glBindRenderbuffer(GL_RENDERBUFFER, pickDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width(), height());
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, pickColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, pickDepth);
+
+        pickSize = size();
+    }
 
-    glDisable(GL_POINT_SMOOTH);
+    GLuint background[4] = {BACKGROUND_KEY, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, background);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    glDisable(GL_BLEND);
+    if (!core)
+        glDisable(GL_POINT_SMOOTH);
     glDisable(GL_LINE_SMOOTH);
     glDisable(GL_MULTISAMPLE);
 
@@ -93,27 +176,107 @@ std::set<std::pair<uint,uint>> GLWidget::paintGLPicks(int x, int y, int w, int h
     matrix(&mvp);
 
     for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
-        i->second->drawPicking(mvp, ccProgram, objectSet->selectionMode());
+        i->second->drawPicking(mvp, pickProgram, pickLineProgram, objectSet->selectionMode(), _exteriorOnly);
+
+    glEnable(GL_MULTISAMPLE);
+    glEnable(GL_LINE_SMOOTH);
+    if (!core)
+        glEnable(GL_POINT_SMOOTH);
+    glEnable(GL_BLEND);
 
-    GLubyte pixels[4 * w * h];
-    glReadPixels(x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
 
-    std::unordered_map<uint, uint> picks;
-    for (int i = 0; i < w * h; i++)
+    pickDirty = false;
+}
+
+
+// Counts pixels per (object key, component) pair, packed into 64-bit keys. Neighbouring pixels
+// mostly share a key, so the hash map is only touched once per run. Runs longer than a pixel are
+// scanned two pixels per SSE2 comparison where available.
+static void countKeys(const GLuint *keys, uint n, std::unordered_map<uint64_t, uint> &counts)
+{
+    uint i = 0;
+    while (i < n)
     {
-        uint key = DisplayObject::colorToKey(&pixels[4*i]);
+        uint start = i++;
 
-        if (picks.find(key) != picks.end())
-            picks[key]++;
-        else
-            picks[key] = 1;
+#ifdef __SSE2__
+        if (i < n && keys[2*i] == keys[2*start] && keys[2*i+1] == keys[2*start+1])
+        {
+            __m128i run = _mm_set_epi32(keys[2*start+1], keys[2*start], keys[2*start+1], keys[2*start]);
+            while (i + 2 <= n &&
+                   _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (keys + 2*i)), run)) == 0xffff)
+                i += 2;
+        }
+#endif
+
+        while (i < n && keys[2*i] == keys[2*start] && keys[2*i+1] == keys[2*start+1])
+            i++;
+
+        counts[(uint64_t) keys[2*start] << 32 | keys[2*start+1]] += i - start;
     }
+}
 
-    std::set<uint> deletes;
+
+std::set<std::pair<uint,uint>> GLWidget::readPicks(int x, int y, int w, int h)
+{
+    if (pickDirty)
+        paintPickBuffer();
+
+    // The region is read back in tiles of whole rows through two pixel buffer objects, so the
+    // transfer of one tile overlaps with the reduction of the previous one, and memory use is
+    // bounded regardless of the size of the region
+    int rows = std::max(1, std::min(h, PICK_TILE_PIXELS / w));
+    int nTiles = (h + rows - 1) / rows;
+    uint tileBytes = 2 * sizeof(GLuint) * w * rows;
+
+    if (!pickPbo[0])
+        glGenBuffers(2, pickPbo);
+    if (pickPboSize < tileBytes)
+    {
+        for (auto pbo : pickPbo)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, tileBytes, NULL, GL_STREAM_READ);
+        }
+        pickPboSize = tileBytes;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, pickFbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    auto readTile = [this, x, y, w, h, rows] (int tile) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pickPbo[tile % 2]);
+        glReadPixels(x, y + tile * rows, w, std::min(rows, h - tile * rows), GL_RG_INTEGER, GL_UNSIGNED_INT, 0);
+    };
+
+    std::unordered_map<uint64_t, uint> picks;
+
+    readTile(0);
+    for (int tile = 0; tile < nTiles; tile++)
+    {
+        if (tile + 1 < nTiles)
+            readTile(tile + 1);
+
+        uint n = w * std::min(rows, h - tile * rows);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pickPbo[tile % 2]);
+        const GLuint *keys = (const GLuint *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                               2 * sizeof(GLuint) * n, GL_MAP_READ_BIT);
+        if (keys)
+        {
+            countKeys(keys, n, picks);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    std::set<uint64_t> deletes;
 
     int limit = std::min(std::min(w, h) - 1, 2);
     for (auto p : picks)
-        if (p.second < limit || p.first == WHITE_KEY)
+        if (p.second < limit || p.first >> 32 == BACKGROUND_KEY)
             deletes.insert(p.first);
 
     for (auto p : deletes)
@@ -121,15 +284,7 @@ std::set<std::pair<uint,uint>> GLWidget::paintGLPicks(int x, int y, int w, int h
     
     std::set<std::pair<uint,uint>> ret;
     for (auto p : picks)
-    {
-        uint index, offset;
-        DisplayObject::keyToIndex(p.first, &index, &offset);
-        ret.insert(std::pair<uint,uint>(index, offset));
-    }
-
-    glEnable(GL_MULTISAMPLE);
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_POINT_SMOOTH);
+        ret.insert(std::pair<uint,uint>(DisplayObject::keyToIndex(p.first >> 32), p.first & 0xffffffff));
 
     return ret;
 }
@@ -139,14 +294,55 @@ void GLWidget::paintGL()
 {
     std::lock(m, DisplayObject::m);
 
-    glClearColor(1.0, 1.0, 1.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    QOpenGLVertexArrayObject::Binder binder(&vao);
 
-    QMatrix4x4 mvp;
-    matrix(&mvp);
+    if (!sceneCache || sceneCache->size() != size())
+    {
+        delete sceneCache;
 
-    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
-        i->second->draw(mvp, ccProgram, _showPoints || objectSet->selectionMode() == SM_POINT);
+        QOpenGLFramebufferObjectFormat fmt;
+        fmt.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+        fmt.setSamples(std::max(format().samples(), 0));
+        sceneCache = new QOpenGLFramebufferObject(size(), fmt);
+
+        sceneDirty = true;
+    }
+
+    // Patches that were culled in the last scene render but whose proxies turned out to be
+    // visible are drawn now, one frame late at most
+    if (proxiesPending)
+    {
+        proxiesPending = false;
+        if (checkProxies())
+            sceneDirty = true;
+    }
+
+    if (sceneDirty)
+    {
+        sceneCache->bind();
+        paintScene();
+
+        sceneDirty = false;
+    }
+
+    // Mouse moves only record the position, so the hover lookup runs at most once per frame. It
+    // waits while the camera moves, so camera frames never render the pick buffer.
+    if (hoverPending && !cameraTracking)
+    {
+        hoverPending = false;
+        hovering = hoverPick(hoverPos, &hover);
+        hoverMode = objectSet->selectionMode();
+    }
+
+    // Depth is copied as well, so overlays can be depth tested against the scene
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneCache->handle());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+    glBlitFramebuffer(0, 0, width(), height(), 0, 0, width(), height(),
+                      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    if (hovering)
+        drawHover();
 
     if (_showAxes)
     {
@@ -162,13 +358,188 @@ void GLWidget::paintGL()
         glEnable(GL_DEPTH_TEST);
     }
 
-    swapBuffers();
+    if (lassoTracking)
+    {
+        glDisable(GL_DEPTH_TEST);
+        drawLasso();
+        glEnable(GL_DEPTH_TEST);
+    }
 
     m.unlock();
     DisplayObject::m.unlock();
 }
 
 
+void GLWidget::paintScene()
+{
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    QMatrix4x4 mvp;
+    matrix(&mvp);
+
+    bool showPoints = _showPoints || objectSet->selectionMode() == SM_POINT;
+
+    if (_occlusionCulling)
+    {
+        paintSceneCulled(mvp, showPoints);
+        return;
+    }
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+        i->second->draw(mvp, ccProgram, ccLineProgram, showPoints, _singlePassLines, _exteriorOnly);
+}
+
+
+void GLWidget::paintSceneCulled(QMatrix4x4 &mvp, bool showPoints)
+{
+    // Drop the queries of patches that no longer exist
+    for (auto i = occlusion.begin(); i != occlusion.end(); )
+        if (DisplayObject::getObject(i->first) != i->second.obj)
+        {
+            glDeleteQueries(1, &i->second.query);
+            i = occlusion.erase(i);
+        }
+        else
+            i++;
+
+    std::vector<std::pair<float, DisplayObject *>> visible;
+    std::vector<DisplayObject *> culled;
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+    {
+        DisplayObject *obj = i->second;
+        if (!obj->initialized() || obj->isInvisible(showPoints))
+            continue;
+
+        auto o = occlusion.find(i->first);
+        if (o == occlusion.end())
+        {
+            Occlusion state = { obj, 0, true, false, false };
+            glGenQueries(1, &state.query);
+            o = occlusion.insert(std::make_pair(i->first, state)).first;
+        }
+
+        // Results from the previous scene render. If they are not in yet, assume visibility.
+        Occlusion &state = o->second;
+        if (state.issued)
+        {
+            GLuint available = 0, samples = 0;
+            glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samples);
+            state.visible = !available || samples > 0;
+            state.issued = false;
+        }
+
+        // Proxies that cross the near plane are clipped and can't be trusted
+        bool clipped = false;
+        QVector3D pad = QVector3D(1, 1, 1) * PROXY_PADDING * obj->radius();
+        QVector3D lo = obj->boxMin() - pad, hi = obj->boxMax() + pad;
+        for (int c = 0; c < 8 && !clipped; c++)
+        {
+            QVector4D corner = mvp * QVector4D(c & 1 ? hi.x() : lo.x(),
+                                               c & 2 ? hi.y() : lo.y(),
+                                               c & 4 ? hi.z() : lo.z(), 1.0);
+            clipped = corner.w() <= 0.0 || corner.z() < -corner.w();
+        }
+
+        if (state.visible || clipped)
+            visible.push_back(std::make_pair((mvp * QVector4D(obj->center(), 1.0)).w(), obj));
+        else
+            culled.push_back(obj);
+    }
+
+    // Front to back, so that the nearest patches occlude the rest as early as possible
+    std::sort(visible.begin(), visible.end(),
+              [] (const std::pair<float, DisplayObject *> &a, const std::pair<float, DisplayObject *> &b) {
+                  return a.first < b.first;
+              });
+
+    for (auto v : visible)
+    {
+        Occlusion &state = occlusion[v.second->index()];
+
+        glBeginQuery(GL_SAMPLES_PASSED, state.query);
+        v.second->draw(mvp, ccProgram, ccLineProgram, showPoints, _singlePassLines, _exteriorOnly);
+        glEndQuery(GL_SAMPLES_PASSED);
+
+        state.issued = true;
+        state.proxy = false;
+    }
+
+    if (culled.empty())
+        return;
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+
+    for (auto obj : culled)
+    {
+        Occlusion &state = occlusion[obj->index()];
+
+        glBeginQuery(GL_SAMPLES_PASSED, state.query);
+        drawProxy(mvp, obj);
+        glEndQuery(GL_SAMPLES_PASSED);
+
+        state.issued = true;
+        state.proxy = true;
+    }
+
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    proxiesPending = true;
+    update();
+}
+
+
+bool GLWidget::checkProxies()
+{
+    bool found = false;
+
+    for (auto &o : occlusion)
+    {
+        Occlusion &state = o.second;
+        if (!state.issued || !state.proxy)
+            continue;
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samples);
+
+        state.issued = false;
+        state.visible = samples > 0;
+        found |= state.visible;
+    }
+
+    return found;
+}
+
+
+void GLWidget::drawProxy(QMatrix4x4 &mvp, DisplayObject *obj)
+{
+    // Padded, so that flat patches and curves still have a proxy with some area
+    QVector3D pad = QVector3D(1, 1, 1) * PROXY_PADDING * obj->radius();
+
+    QMatrix4x4 boxMvp = mvp;
+    boxMvp.translate(obj->boxMin() - pad);
+    boxMvp.scale(obj->boxMax() - obj->boxMin() + 2 * pad);
+
+    ccProgram.bind();
+
+    boxBuffer.bind();
+    ccProgram.enableAttributeArray("vertexPosition");
+    ccProgram.setAttributeBuffer("vertexPosition", GL_FLOAT, 0, 3);
+    ccProgram.disableAttributeArray("vertexNormal");
+
+    ccProgram.setUniformValue("mvp", boxMvp);
+    ccProgram.setUniformValue("p", 0.0f);
+
+    boxIdxBuffer.bind();
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+}
+
+
 void GLWidget::drawAxes()
 {
     vcProgram.bind();
@@ -186,7 +557,7 @@ void GLWidget::drawAxes()
     vcProgram.setUniformValue("mvp", mvp);
 
     axesBuffer.bind();
-    glLineWidth(3.0);
+    DisplayObject::setLineWidth(vcProgram, 3.0);
     glDrawElements(GL_LINES, 2 * 3, GL_UNSIGNED_INT, 0);
 }
 
@@ -210,7 +581,7 @@ void GLWidget::drawSelection()
     mvp.scale((float) d.x()/width()*2.0, - (float) d.y()/height()*2.0, 1.0);
     ccProgram.setUniformValue("mvp", mvp);
 
-    ccProgram.setUniformValue("col", QVector4D(0,0,0,0.6));
+    ccProgram.setUniformValue("col", QVector3D(0,0,0));
 
     selectionBuffer.bind();
     glLineWidth(1.0);
@@ -220,14 +591,96 @@ void GLWidget::drawSelection()
 }
 
 
+void GLWidget::drawLasso()
+{
+    std::vector<QVector3D> data;
+    for (auto &p : lasso)
+        data.push_back(QVector3D((float) p.x() / width() * 2.0 - 1.0,
+                                 1.0 - (float) p.y() / height() * 2.0, 0.0));
+
+    glDisable(GL_LINE_SMOOTH);
+
+    ccProgram.bind();
+
+    lassoBuffer.bind();
+    lassoBuffer.allocate(&data[0], data.size() * sizeof(QVector3D));
+    ccProgram.enableAttributeArray("vertexPosition");
+    ccProgram.setAttributeBuffer("vertexPosition", GL_FLOAT, 0, 3);
+    ccProgram.disableAttributeArray("vertexNormal");
+
+    QMatrix4x4 mvp;
+    mvp.setToIdentity();
+    ccProgram.setUniformValue("mvp", mvp);
+    ccProgram.setUniformValue("p", 0.0f);
+    ccProgram.setUniformValue("col", QVector3D(0,0,0));
+
+    glLineWidth(1.0);
+    glDrawArrays(GL_LINE_LOOP, 0, data.size());
+
+    glEnable(GL_LINE_SMOOTH);
+}
+
+
+void GLWidget::drawHover()
+{
+    // The component is only meaningful in the mode it was picked in
+    DisplayObject *obj = DisplayObject::getObject(hover.first);
+    if (!obj || hoverMode != objectSet->selectionMode())
+        return;
+
+    QMatrix4x4 mvp;
+    matrix(&mvp);
+
+    GLint depthFunc;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+
+    glDepthFunc(GL_LEQUAL);
+    obj->drawHover(mvp, ccProgram, ccLineProgram, objectSet->selectionMode(), hover.second);
+    glDepthFunc(depthFunc);
+}
+
+
+bool GLWidget::hoverPick(QPoint pos, std::pair<uint,uint> *pick)
+{
+    int x = pos.x(), y = height() - 1 - pos.y();
+    if (x < 0 || y < 0 || x >= width() || y >= height())
+        return false;
+
+    // Either a BVH query or a single pixel from the cached pick buffer, which is only re-rendered
+    // after the scene has changed
+    std::set<std::pair<uint,uint>> picks;
+    if (_cpuPicking)
+    {
+        QMatrix4x4 mvp;
+        matrix(&mvp);
+        picks = Picker(mvp, width(), height(), _exteriorOnly).pick(x, y, 1, 1, objectSet->selectionMode());
+    }
+    else
+        picks = readPicks(x, y, 1, 1);
+
+    if (picks.empty())
+        return false;
+
+    *pick = *picks.begin();
+    return true;
+}
+
+
 void GLWidget::resizeGL(int w, int h)
 {
     m.lock();
     glViewport(0, 0, w, h);
+    pickDirty = true;
     m.unlock();
 }
 
 
+QString GLWidget::shaderPath(QString name)
+{
+    return QString(core ? ":/shaders/core/%1.glsl" : ":/shaders/%1.glsl").arg(name);
+}
+
+
 bool addShader(QOpenGLShaderProgram &program, QOpenGLShader::ShaderType type, QString fileName)
 {
     QFile file(fileName);
@@ -244,30 +697,66 @@ void GLWidget::initializeGL()
 {
     m.lock();
 
+    initializeOpenGLFunctions();
+    core = format().profile() == QSurfaceFormat::CoreProfile;
+
+    // Core profiles require a bound vertex array object, the legacy renderer is happy with one
+    vao.create();
+
     glEnable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_MULTISAMPLE);
     glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_POINT_SMOOTH);
+    if (!core)
+        glEnable(GL_POINT_SMOOTH);
     glDepthFunc(GL_LEQUAL);
     glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 
-    if (!addShader(vcProgram, QOpenGLShader::Vertex, ":/shaders/varying_vertex.glsl"))
+    if (!addShader(vcProgram, QOpenGLShader::Vertex, shaderPath("varying_vertex")))
+        close();
+    if (!addShader(vcProgram, QOpenGLShader::Fragment, shaderPath("varying_fragment")))
         close();
-    if (!addShader(vcProgram, QOpenGLShader::Fragment, ":/shaders/varying_fragment.glsl"))
+    if (core && !addShader(vcProgram, QOpenGLShader::Geometry, shaderPath("varying_line_geometry")))
         close();
     if (!vcProgram.link())
         close();
 
-    if (!addShader(ccProgram, QOpenGLShader::Vertex, ":/shaders/constant_vertex.glsl"))
+    if (!addShader(ccProgram, QOpenGLShader::Vertex, shaderPath("constant_vertex")))
         close();
-    if (!addShader(ccProgram, QOpenGLShader::Fragment, ":/shaders/constant_fragment.glsl"))
+    if (!addShader(ccProgram, QOpenGLShader::Fragment, shaderPath("constant_fragment")))
         close();
     if (!ccProgram.link())
         close();
 
+    if (!addShader(pickProgram, QOpenGLShader::Vertex, shaderPath("constant_vertex")))
+        close();
+    if (!addShader(pickProgram, QOpenGLShader::Fragment, shaderPath("picking_fragment")))
+        close();
+    if (!pickProgram.link())
+        close();
+
+    if (!addShader(ccLineProgram, QOpenGLShader::Vertex, shaderPath("constant_vertex")))
+        close();
+    if (!addShader(ccLineProgram, QOpenGLShader::Fragment, shaderPath("constant_fragment")))
+        close();
+    if (core && !addShader(ccLineProgram, QOpenGLShader::Geometry, shaderPath("line_geometry")))
+        close();
+    if (!ccLineProgram.link())
+        close();
+
+    if (!addShader(pickLineProgram, QOpenGLShader::Vertex, shaderPath("constant_vertex")))
+        close();
+    if (!addShader(pickLineProgram, QOpenGLShader::Fragment, shaderPath("picking_fragment")))
+        close();
+    if (core && !addShader(pickLineProgram, QOpenGLShader::Geometry, shaderPath("line_geometry")))
+        close();
+    if (!pickLineProgram.link())
+        close();
+
+    QOpenGLVertexArrayObject::Binder binder(&vao);
+
     std::vector<QVector3D> auxData = {
         QVector3D(0,0,0), QVector3D(1,0,0),
         QVector3D(0,0,0), QVector3D(0,1,0),
@@ -291,6 +780,9 @@ void GLWidget::initializeGL()
     selectionBuffer.bind();
     selectionBuffer.allocate(&selectionData[0], 4 * sizeof(GLuint));
 
+    lassoBuffer.create();
+    lassoBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
     std::vector<QVector3D> auxColors = {
         QVector3D(1,0,0), QVector3D(1,0,0),
         QVector3D(0,1,0), QVector3D(0,1,0),
@@ -302,6 +794,25 @@ void GLWidget::initializeGL()
     auxCBuffer.bind();
     auxCBuffer.allocate(&auxColors[0], 7 * 3 * sizeof(float));
 
+    std::vector<QVector3D> boxData = {
+        QVector3D(0,0,0), QVector3D(1,0,0), QVector3D(0,1,0), QVector3D(1,1,0),
+        QVector3D(0,0,1), QVector3D(1,0,1), QVector3D(0,1,1), QVector3D(1,1,1)
+    };
+    boxBuffer.create();
+    boxBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    boxBuffer.bind();
+    boxBuffer.allocate(&boxData[0], 8 * 3 * sizeof(float));
+
+    std::vector<GLuint> boxIdxData = {
+        0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,   2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5
+    };
+    boxIdxBuffer.create();
+    boxIdxBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    boxIdxBuffer.bind();
+    boxIdxBuffer.allocate(&boxIdxData[0], 36 * sizeof(GLuint));
+
     m.unlock();
 }
 
@@ -351,12 +862,46 @@ void GLWidget::mousePressEvent(QMouseEvent *event)
         mouseOrigRoll = _roll;
         mouseOrigLookAt = _lookAt;
     }
-    else if (event->button() == Qt::LeftButton)
+    else if (event->button() == Qt::LeftButton && _selectionTool == SELECT_RECTANGLE)
     {
         selectTracking = true;
         selectOrig = event->pos();
         selectTo = event->pos();
     }
+    else if (event->button() == Qt::LeftButton && _selectionTool == SELECT_LASSO)
+    {
+        lassoTracking = true;
+        lasso = {event->pos()};
+    }
+    else if (event->button() == Qt::LeftButton && _selectionTool == SELECT_POLYGON)
+    {
+        // The last vertex follows the cursor. Clicking close to the first vertex closes the polygon.
+        if (!lassoTracking)
+        {
+            lassoTracking = true;
+            lasso = {event->pos(), event->pos()};
+        }
+        else if (lasso.size() > 3 && (event->pos() - lasso.front()).manhattanLength() <= LASSO_SNAP)
+        {
+            lasso.pop_back();
+            finishLasso();
+        }
+        else
+            lasso.push_back(event->pos());
+        update();
+    }
+}
+
+
+void GLWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton && _selectionTool == SELECT_POLYGON && lassoTracking)
+    {
+        lasso.pop_back();
+        finishLasso();
+    }
+    else
+        mousePressEvent(event);
 }
 
 
@@ -364,7 +909,9 @@ void GLWidget::mouseReleaseEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::RightButton)
         cameraTracking = false;
-    else if (event->button() == Qt::LeftButton)
+    else if (event->button() == Qt::LeftButton && _selectionTool == SELECT_LASSO && lassoTracking)
+        finishLasso();
+    else if (event->button() == Qt::LeftButton && selectTracking)
     {
         std::lock(m, DisplayObject::m);
 
@@ -375,8 +922,22 @@ void GLWidget::mouseReleaseEvent(QMouseEvent *event)
         int toX = std::min(std::max(event->pos().x(), selectOrig.x()), width() - 1);
         int toY = std::min(height() - std::min(event->pos().y(), selectOrig.y()), height() - 1);
 
-        makeCurrent();
-        std::set<std::pair<uint,uint>> picks = paintGLPicks(x, y, toX - x + 1, toY - y + 1);
+        // With alt held, occluded components are picked as well. This needs the geometry, not the
+        // pick buffer, so it always goes through the CPU picker.
+        std::set<std::pair<uint,uint>> picks;
+        if (_cpuPicking || altPressed)
+        {
+            QMatrix4x4 mvp;
+            matrix(&mvp);
+            picks = Picker(mvp, width(), height(), _exteriorOnly).pick(x, y, toX - x + 1, toY - y + 1,
+                                                        objectSet->selectionMode(), altPressed);
+        }
+        else
+        {
+            makeCurrent();
+            picks = readPicks(x, y, toX - x + 1, toY - y + 1);
+            doneCurrent();
+        }
 
         m.unlock();
         DisplayObject::m.unlock();
@@ -394,6 +955,25 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
         update();
     }
 
+    if (lassoTracking && _selectionTool == SELECT_LASSO)
+    {
+        if ((event->pos() - lasso.back()).manhattanLength() >= LASSO_SPACING)
+            lasso.push_back(event->pos());
+        update();
+    }
+    else if (lassoTracking)
+    {
+        lasso.back() = event->pos();
+        update();
+    }
+
+    if (!cameraTracking && !selectTracking && !lassoTracking)
+    {
+        hoverPos = event->pos();
+        hoverPending = true;
+        update();
+    }
+
     if (!cameraTracking)
         return;
 
@@ -431,6 +1011,63 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
 }
 
 
+void GLWidget::finishLasso()
+{
+    lassoTracking = false;
+    update();
+
+    if (lasso.size() < 3)
+        return;
+
+    std::vector<QPointF> points;
+    for (auto &p : lasso)
+        points.push_back(QPointF(p.x() + 0.5, height() - p.y() - 0.5));
+
+    std::lock(m, DisplayObject::m);
+
+    // Lassos are always resolved by the CPU picker, which tests sample points against the polygon
+    QMatrix4x4 mvp;
+    matrix(&mvp);
+    Lasso polygon(points);
+    std::set<std::pair<uint,uint>> picks = Picker(mvp, width(), height(), _exteriorOnly).pick(polygon, objectSet->selectionMode(),
+                                                                                altPressed);
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    objectSet->setSelection(&picks, !ctrlPressed);
+}
+
+
+bool GLWidget::cancelLasso()
+{
+    if (!lassoTracking)
+        return false;
+
+    lassoTracking = false;
+    update();
+    return true;
+}
+
+
+void GLWidget::setSelectionTool(selectTool val)
+{
+    cancelLasso();
+    _selectionTool = val;
+}
+
+
+void GLWidget::leaveEvent(QEvent *event)
+{
+    hoverPending = false;
+    if (hovering)
+    {
+        hovering = false;
+        update();
+    }
+}
+
+
 void GLWidget::wheelEvent(QWheelEvent *event)
 {
     if (abs(event->angleDelta().y()) > 1000)
@@ -454,7 +1091,7 @@ void GLWidget::setInclination(double val)
     _inclination = val;
 
     emit inclinationChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -467,7 +1104,7 @@ void GLWidget::setAzimuth(double val)
     _azimuth = val;
 
     emit azimuthChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -480,7 +1117,7 @@ void GLWidget::setRoll(double val)
     _roll = val;
 
     emit rollChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -493,7 +1130,7 @@ void GLWidget::setFov(double val)
     _fov = val;
 
     emit fovChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -506,7 +1143,7 @@ void GLWidget::setZoom(double val)
     _zoom = val;
 
     emit zoomChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -515,7 +1152,7 @@ void GLWidget::setLookAt(QVector3D pt, bool fromMouse)
     _lookAt = pt;
 
     emit lookAtChanged(pt, fromMouse);
-    update();
+    invalidate();
 }
 
 
@@ -534,7 +1171,7 @@ void GLWidget::setPerspective(bool val)
         orthoOrigFov = _fov;
 
     emit perspectiveChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -607,7 +1244,7 @@ void GLWidget::setDir(direction val)
     _dir = val;
 
     emit dirChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -616,7 +1253,7 @@ void GLWidget::setRightHanded(bool val)
     _rightHanded = val;
 
     emit rightHandedChanged(val);
-    update();
+    invalidate();
 }
 
 
@@ -633,16 +1270,78 @@ void GLWidget::setShowPoints(bool val)
 {
     _showPoints = val;
 
+    invalidate();
+}
+
+
+void GLWidget::setSinglePassLines(bool val)
+{
+    _singlePassLines = val;
+
+    invalidate();
+}
+
+
+void GLWidget::setExteriorOnly(bool val)
+{
+    _exteriorOnly = val;
+
+    invalidate();
+}
+
+
+void GLWidget::setOcclusionCulling(bool val)
+{
+    _occlusionCulling = val;
+
+    invalidate();
+}
+
+
+void GLWidget::invalidate()
+{
+    pickDirty = true;
+    invalidateScene();
+}
+
+
+void GLWidget::invalidateScene()
+{
+    sceneDirty = true;
     update();
 }
 
 
+void GLWidget::resetHover()
+{
+    // The hovered pair refers to the old mode or to objects whose indices may have been reused,
+    // so it is looked up again once the camera is still
+    hovering = false;
+    if (underMouse())
+    {
+        hoverPos = mapFromGlobal(QCursor::pos());
+        hoverPending = true;
+    }
+
+    invalidate();
+}
+
+
 void GLWidget::initializeDispObject(DisplayObject *obj)
 {
     m.lock();
-    makeCurrent();
-    obj->initialize();
+
+    // The context is created when the widget is first shown, until then the caller has to retry
+    if (isValid())
+    {
+        makeCurrent();
+        obj->initialize();
+        doneCurrent();
+    }
+
     m.unlock();
+
+    resetHover();
 }
 
 
@@ -4,10 +4,13 @@
 #include <QVector3D>
 #include <QVector4D>
 
-#include <QGLWidget>
 #include <QMatrix4x4>
 #include <QMouseEvent>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLWidget>
 #include <QSize>
 #include <QWheelEvent>
 
@@ -22,8 +25,9 @@
 
 enum direction { POSX, NEGX, POSY, NEGY, POSZ, NEGZ };
 enum preset { VIEW_TOP, VIEW_BOTTOM, VIEW_LEFT, VIEW_RIGHT, VIEW_FRONT, VIEW_BACK, VIEW_FREE };
+enum selectTool { SELECT_RECTANGLE, SELECT_LASSO, SELECT_POLYGON };
 
-class GLWidget : public QGLWidget
+class GLWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 {
     Q_OBJECT
 
@@ -74,11 +78,30 @@ public:
     inline bool showPoints() { return _showPoints; }
     void setShowPoints(bool val);
 
+    inline bool singlePassLines() { return _singlePassLines; }
+    void setSinglePassLines(bool val);
+
+    inline bool exteriorOnly() { return _exteriorOnly; }
+    void setExteriorOnly(bool val);
+
+    inline bool occlusionCulling() { return _occlusionCulling; }
+    void setOcclusionCulling(bool val);
+
+    inline bool cpuPicking() { return _cpuPicking; }
+    inline void setCpuPicking(bool val) { _cpuPicking = val; }
+
+    inline selectTool selectionTool() { return _selectionTool; }
+    void setSelectionTool(selectTool val);
+    bool cancelLasso();
+
     void keyPressEvent(QKeyEvent *event);
     void keyReleaseEvent(QKeyEvent *event);
 
 public slots:
     void initializeDispObject(DisplayObject *obj);
+    void invalidate();
+    void invalidateScene();
+    void resetHover();
 
 signals:
     void inclinationChanged(double val);
@@ -97,35 +120,81 @@ protected:
     void initializeGL();
     void resizeGL(int w, int h);
     void paintGL();
-    std::set<std::pair<uint,uint>> paintGLPicks(int x, int y, int w, int h);
+    void paintPickBuffer();
+    std::set<std::pair<uint,uint>> readPicks(int x, int y, int w, int h);
 
     void mousePressEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+    void leaveEvent(QEvent *event);
     void wheelEvent(QWheelEvent *event);
 
 private:
     void drawAxes();
     void drawSelection();
+    void drawHover();
+    void drawLasso();
+    void finishLasso();
+    bool hoverPick(QPoint pos, std::pair<uint,uint> *pick);
     void matrix(QMatrix4x4 *);
     void axesMatrix(QMatrix4x4 *);
     void multiplyDir(QMatrix4x4 *);
 
-    QOpenGLShaderProgram vcProgram, ccProgram;
-    QOpenGLBuffer auxBuffer, axesBuffer, selectionBuffer, auxCBuffer;
+    void paintScene();
+    void paintSceneCulled(QMatrix4x4 &mvp, bool showPoints);
+    bool checkProxies();
+    void drawProxy(QMatrix4x4 &mvp, DisplayObject *obj);
+    QString shaderPath(QString name);
+
+    bool core;
+    QOpenGLVertexArrayObject vao;
+
+    // The line programs expand wide lines in a geometry shader on core profiles
+    QOpenGLShaderProgram vcProgram, ccProgram, pickProgram, ccLineProgram, pickLineProgram;
+    QOpenGLBuffer auxBuffer, axesBuffer, selectionBuffer, auxCBuffer, boxBuffer, boxIdxBuffer, lassoBuffer;
+
+    QOpenGLFramebufferObject *sceneCache;
+    bool sceneDirty;
+
+    struct Occlusion
+    {
+        DisplayObject *obj;
+        GLuint query;
+        bool visible, issued, proxy;
+    };
+
+    std::unordered_map<uint, Occlusion> occlusion;
+    bool proxiesPending;
+
+    GLuint pickFbo, pickColor, pickDepth;
+    GLuint pickPbo[2];
+    uint pickPboSize;
+    QSize pickSize;
+    bool pickDirty;
 
     ObjectSet *objectSet;
 
     bool shiftPressed, ctrlPressed, altPressed;
 
     double _inclination, _azimuth, _roll, _fov, _zoom, _diameter;
-    bool _perspective, _fixed, _rightHanded, _showAxes, _showPoints;
+    bool _perspective, _fixed, _rightHanded, _showAxes, _showPoints, _singlePassLines, _exteriorOnly;
+    bool _occlusionCulling, _cpuPicking;
     QVector3D _lookAt;
     direction _dir;
 
     bool selectTracking;
     QPoint selectOrig, selectTo;
 
+    selectTool _selectionTool;
+    bool lassoTracking;
+    std::vector<QPoint> lasso;
+
+    bool hoverPending, hovering;
+    QPoint hoverPos;
+    std::pair<uint,uint> hover;
+    SelectionMode hoverMode;
+
     bool cameraTracking;
     QPoint mouseOrig;
     double mouseOrigInclination, mouseOrigAzimuth, mouseOrigRoll;
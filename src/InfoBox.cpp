@@ -1,7 +1,6 @@
-#include <iostream>
-#include <QColor>
-#include <QDateTime>
 #include <QFont>
+#include <QGridLayout>
+#include <QLabel>
 #include <QTabWidget>
 
 #include "InfoBox.h"
@@ -16,45 +15,51 @@ InfoBox::InfoBox(ObjectSet *objectSet, QWidget *parent)
     addTab(new QWidget(), "Pick");
     addTab(new QWidget(), "Files");
 
-    logBox = new QTextEdit();
-    logBox->setReadOnly(true);
-    logBox->setFont(QFont("Source Code Pro, monospace", 10));
-    addTab(logBox, "Log");
+    QWidget *logPanel = new QWidget();
+    QGridLayout *logLayout = new QGridLayout();
+    logPanel->setLayout(logLayout);
 
-    setCurrentIndex(3);
+    logModel = new LogModel(this);
 
-    QObject::connect(objectSet, &ObjectSet::log, this, &InfoBox::log);
-}
+    // Uniform item sizes let the view lay out only the visible rows
+    logView = new QListView();
+    logView->setModel(logModel);
+    logView->setUniformItemSizes(true);
+    logView->setFont(QFont("Source Code Pro, monospace", 10));
+    logView->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    logLayout->addWidget(logView, 0, 0, 1, 4);
 
+    QObject::connect(logModel, &LogModel::rowsInserted, logView, &QListView::scrollToBottom);
 
-void InfoBox::log(QString text, LogLevel level)
-{
-    QString logString = "<span style=\"color:#a9a9a9;\">[%1]</span> %2 %4 %3";
+    logLevel = new QComboBox();
+    logLevel->addItems({"All messages", "Warnings and errors", "Errors only"});
+    logLayout->addWidget(new QLabel("Show"), 1, 0, 1, 1);
+    logLayout->addWidget(logLevel, 1, 1, 1, 1);
 
-    logString = logString.arg(QDateTime::currentDateTime().toString("HH:mm:ss"));
+    QObject::connect(logLevel, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                     [this] (int index) { logModel->setMinLevel((LogLevel) index); });
 
-    switch (level)
-    {
-    case LL_NORMAL:
-        logString = logString.arg("", "");;
-        break;
+    logCapacity = new QSpinBox();
+    logCapacity->setRange(100, 1000000);
+    logCapacity->setSingleStep(1000);
+    logCapacity->setValue(logModel->capacity());
+    logLayout->addWidget(new QLabel("Keep"), 1, 2, 1, 1);
+    logLayout->addWidget(logCapacity, 1, 3, 1, 1);
 
-    case LL_WARNING:
-        logString = logString.arg("<span style=\"color:#ffa500; font-weight: bold;\">WARNING</span>", "");
-        break;
+    QObject::connect(logCapacity, &QSpinBox::editingFinished,
+                     [this] () { logModel->setCapacity(logCapacity->value()); });
 
-    case LL_ERROR:
-        logString = logString.arg("<span style=\"color:#ff4500; font-weight: bold;\">ERROR</span>", "");
-        std::cerr << "ERROR: " << text.toStdString() << std::endl;
-        break;
+    logLayout->setColumnStretch(1, 1);
+    logLayout->setColumnStretch(3, 1);
+    addTab(logPanel, "Log");
 
-    case LL_FATAL:
-        logString = logString.arg("<span style=\"color:#ff0000; font-weight: bold;\">FATAL!", "</span>");
-        std::cerr << "FATAL ERROR: " << text.toStdString() << std::endl;
-        break;
-    }
+    setCurrentIndex(3);
+
+    QObject::connect(objectSet, &ObjectSet::log, this, &InfoBox::log);
+}
 
-    logString = logString.arg(text);
 
-    logBox->append(logString);
+void InfoBox::log(QString text, LogLevel level)
+{
+    logModel->append(text, level);
 }
@@ -1,6 +1,9 @@
+#include <QComboBox>
+#include <QListView>
+#include <QSpinBox>
 #include <QTabWidget>
-#include <QTextEdit>
 
+#include "LogModel.h"
 #include "ObjectSet.h"
 
 #ifndef INFOBOX_H
@@ -20,7 +23,10 @@ public slots:
 private:
     ObjectSet *_objectSet;
 
-    QTextEdit *logBox;
+    LogModel *logModel;
+    QListView *logView;
+    QComboBox *logLevel;
+    QSpinBox *logCapacity;
 };
 
 #endif /* INFOBOX_H */
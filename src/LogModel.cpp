@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <iostream>
+#include <QBrush>
+#include <QColor>
+
+#include "LogModel.h"
+
+// The number of messages kept by default
+#define LOG_CAPACITY 10000
+
+// Milliseconds between adding batches of messages to the model
+#define LOG_FLUSH_INTERVAL 100
+
+
+LogModel::LogModel(QObject *parent)
+    : QAbstractListModel(parent)
+    , ring(LOG_CAPACITY)
+    , total(0)
+    , size(0)
+    , _minLevel(LL_NORMAL)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(LOG_FLUSH_INTERVAL);
+    QObject::connect(&flushTimer, &QTimer::timeout, this, &LogModel::flush);
+}
+
+
+int LogModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : rows.size();
+}
+
+
+QVariant LogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= (int) rows.size())
+        return QVariant();
+
+    const entry &e = ring[rows[index.row()] % ring.size()];
+
+    if (role == Qt::DisplayRole)
+    {
+        static const char *prefixes[] = {"", "WARNING ", "ERROR ", "FATAL! "};
+        return QString("[%1] %2%3").arg(e.time.toString("HH:mm:ss")).arg(prefixes[e.level]).arg(e.text);
+    }
+
+    if (role == Qt::ForegroundRole)
+    {
+        switch (e.level)
+        {
+        case LL_WARNING: return QBrush(QColor("#ffa500"));
+        case LL_ERROR: return QBrush(QColor("#ff4500"));
+        case LL_FATAL: return QBrush(QColor("#ff0000"));
+        default: return QVariant();
+        }
+    }
+
+    return QVariant();
+}
+
+
+void LogModel::setCapacity(uint capacity)
+{
+    flush();
+    capacity = std::max(capacity, 1u);
+
+    beginResetModel();
+
+    uint kept = std::min(size, capacity);
+    std::vector<entry> newRing(capacity);
+    for (uint64_t n = total - kept; n < total; n++)
+        newRing[n % capacity] = ring[n % ring.size()];
+
+    ring.swap(newRing);
+    size = kept;
+    rebuildRows();
+
+    endResetModel();
+}
+
+
+void LogModel::setMinLevel(LogLevel level)
+{
+    flush();
+
+    beginResetModel();
+    _minLevel = level;
+    rebuildRows();
+    endResetModel();
+}
+
+
+void LogModel::append(QString text, LogLevel level)
+{
+    if (level == LL_ERROR)
+        std::cerr << "ERROR: " << text.toStdString() << std::endl;
+    else if (level == LL_FATAL)
+        std::cerr << "FATAL ERROR: " << text.toStdString() << std::endl;
+
+    pending.push_back({QTime::currentTime(), level, text});
+
+    if (!flushTimer.isActive())
+        flushTimer.start();
+}
+
+
+void LogModel::flush()
+{
+    flushTimer.stop();
+    if (pending.empty())
+        return;
+
+    // Messages that would be dropped at once are never stored
+    uint skip = pending.size() > ring.size() ? pending.size() - ring.size() : 0;
+    total += skip;
+
+    uint nNew = pending.size() - skip;
+    uint64_t oldest = total + nNew - std::min((uint64_t) size + nNew, (uint64_t) ring.size());
+
+    // Remove the rows of dropped messages before their slots are reused
+    uint nDropped = 0;
+    while (nDropped < rows.size() && rows[nDropped] < oldest)
+        nDropped++;
+
+    if (nDropped > 0)
+    {
+        beginRemoveRows(QModelIndex(), 0, nDropped - 1);
+        rows.erase(rows.begin(), rows.begin() + nDropped);
+        endRemoveRows();
+    }
+
+    std::vector<uint64_t> newRows;
+    for (uint i = skip; i < pending.size(); i++)
+    {
+        ring[total % ring.size()] = pending[i];
+        if (pending[i].level >= _minLevel)
+            newRows.push_back(total);
+        total++;
+    }
+
+    size = total - oldest;
+    pending.clear();
+
+    if (!newRows.empty())
+    {
+        beginInsertRows(QModelIndex(), rows.size(), rows.size() + newRows.size() - 1);
+        rows.insert(rows.end(), newRows.begin(), newRows.end());
+        endInsertRows();
+    }
+}
+
+
+void LogModel::rebuildRows()
+{
+    rows.clear();
+    for (uint64_t n = total - size; n < total; n++)
+        if (ring[n % ring.size()].level >= _minLevel)
+            rows.push_back(n);
+}
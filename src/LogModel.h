@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <QAbstractListModel>
+#include <QString>
+#include <QTime>
+#include <QTimer>
+
+#include "ObjectSet.h"
+
+#ifndef _LOGMODEL_H_
+#define _LOGMODEL_H_
+
+// The log messages, kept in a ring buffer of a fixed capacity so that the oldest are dropped.
+// Messages are collected and added to the model in batches, and only those of the minimum level
+// or above are shown.
+class LogModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit LogModel(QObject *parent = NULL);
+    ~LogModel() { }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+
+    inline uint capacity() { return ring.size(); }
+    void setCapacity(uint capacity);
+
+    inline LogLevel minLevel() { return _minLevel; }
+    void setMinLevel(LogLevel level);
+
+public slots:
+    void append(QString text, LogLevel level);
+    void flush();
+
+private:
+    typedef struct
+    {
+        QTime time;
+        LogLevel level;
+        QString text;
+    } entry;
+
+    // Message number n is stored at ring[n % capacity()], and the messages from
+    // total - size to total - 1 are kept
+    std::vector<entry> ring;
+    uint64_t total;
+    uint size;
+
+    // The message numbers of the shown rows
+    std::deque<uint64_t> rows;
+
+    LogLevel _minLevel;
+
+    std::vector<entry> pending;
+    QTimer flushTimer;
+
+    void rebuildRows();
+};
+
+#endif /* _LOGMODEL_H_ */
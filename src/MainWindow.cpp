@@ -68,6 +68,45 @@ MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags flags)
             [] () { QApplication::exit(0); });
 
 
+    QMenu *editMenu = menuBar()->addMenu("Edit");
+    QAction *undoAct = editMenu->addAction("Undo");
+    undoAct->setShortcut(QKeySequence::Undo);
+    undoAct->setEnabled(false);
+    QAction *redoAct = editMenu->addAction("Redo");
+    redoAct->setShortcuts(QList<QKeySequence>() << QKeySequence("Ctrl+Y") << QKeySequence("Ctrl+Shift+Z"));
+    redoAct->setEnabled(false);
+
+    connect(undoAct, &QAction::triggered,
+            [this] (bool checked) { _objectSet->undo(); });
+    connect(redoAct, &QAction::triggered,
+            [this] (bool checked) { _objectSet->redo(); });
+    connect(_objectSet, &ObjectSet::historyChanged, this,
+            [undoAct, redoAct] (bool canUndo, bool canRedo) {
+                undoAct->setEnabled(canUndo);
+                redoAct->setEnabled(canRedo);
+            });
+
+
+    QMenu *selectionMenu = menuBar()->addMenu("Selection");
+    QAction *connectedAct = selectionMenu->addAction("Select connected");
+    connectedAct->setShortcut(QKeySequence("Ctrl+L"));
+    QAction *interfacesAct = selectionMenu->addAction("Select shared interfaces");
+
+    connect(connectedAct, &QAction::triggered,
+            [this] (bool checked) { _objectSet->selectConnected(); });
+    connect(interfacesAct, &QAction::triggered,
+            [this] (bool checked) { _objectSet->selectInterfaces(); });
+
+    selectionMenu->addSeparator();
+
+    QAction *acrossAct = selectionMenu->addAction("Select across patch boundaries");
+    acrossAct->setCheckable(true);
+    acrossAct->setChecked(_objectSet->selectAcross());
+
+    connect(acrossAct, &QAction::triggered,
+            [this] (bool checked) { _objectSet->setSelectAcross(checked); });
+
+
     QMenu *windowsMenu = menuBar()->addMenu("Windows");
     _toolAct = windowsMenu->addAction("Toolbox");
     _toolAct->setShortcut(QKeySequence("Ctrl+Shift+T"));
@@ -144,6 +183,11 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
             _objectSet->setSelectionMode(SM_FACE);
         return true;
 
+    case Qt::Key_I:
+        if (e->modifiers().testFlag(Qt::ControlModifier))
+            _objectSet->invertSelection();
+        return true;
+
     case Qt::Key_P:
         if (e->modifiers().testFlag(Qt::ControlModifier))
             _objectSet->setSelectionMode(SM_PATCH);
@@ -174,6 +218,9 @@ bool MainWindow::eventFilter(QObject *obj, QEvent *event)
 
     case Qt::Key_Escape:
     {
+        if (_glWidget->cancelLasso())
+            return true;
+
         std::set<std::pair<uint,uint>> p;
         _objectSet->setSelection(&p, true);
         return true;
@@ -14,6 +14,24 @@
 
 #include "ObjectSet.h"
 
+// The number of changes kept for undo
+#define HISTORY_DEPTH 100
+
+// Above this many changed patches, views are told to refresh everything at once
+#define MAX_DIRTY_PATCHES 1000
+
+
+// Rows below patches are not stored as nodes, but computed from the display object when the views
+// ask for them. Their model indices point to the patch, tagged in the low bits (which are zero by
+// alignment): TAG_COMPONENTS for the rows of component types, and TAG_COMPONENT plus the type for
+// the components themselves.
+#define TAG_MASK 7
+#define TAG_COMPONENTS 1
+#define TAG_COMPONENT 2
+
+static_assert(alignof(Node) > TAG_MASK, "Nodes must be aligned to leave the tag bits free");
+static_assert(alignof(Patch) > TAG_MASK, "Patches must be aligned to leave the tag bits free");
+
 
 inline bool modeMatch(SelectionMode mode, ComponentType type)
 {
@@ -23,9 +41,64 @@ inline bool modeMatch(SelectionMode mode, ComponentType type)
 }
 
 
+inline quintptr tagged(Node *node, quintptr tag)
+{
+    return reinterpret_cast<quintptr>(node) | tag;
+}
+
+
+inline Node *nodeOf(const QModelIndex &index)
+{
+    return reinterpret_cast<Node *>(index.internalId() & ~(quintptr) TAG_MASK);
+}
+
+
+inline NodeType typeOf(const QModelIndex &index)
+{
+    quintptr tag = index.internalId() & TAG_MASK;
+    return tag == 0 ? nodeOf(index)->type() : (tag == TAG_COMPONENTS ? NT_COMPONENTS : NT_COMPONENT);
+}
+
+
+inline uint nComponents(DisplayObject *obj, int type)
+{
+    return type == CT_FACE ? obj->nFaces() : (type == CT_EDGE ? obj->nEdges() : obj->nPoints());
+}
+
+
+// The row of a component type below its patch, counting only the types the object has
+inline int componentRow(DisplayObject *obj, int type)
+{
+    int row = 0;
+    for (int t = CT_FACE; t < type; t++)
+        row += nComponents(obj, t) > 0;
+    return row;
+}
+
+
+inline ComponentType componentType(DisplayObject *obj, int row)
+{
+    for (int t = CT_FACE; t <= CT_POINT; t++)
+        if (nComponents(obj, t) > 0 && row-- == 0)
+            return (ComponentType) t;
+    return CT_POINT;
+}
+
+
+// The component type of a row of either kind below a patch
+inline ComponentType componentTypeOf(const QModelIndex &index)
+{
+    quintptr tag = index.internalId() & TAG_MASK;
+    if (tag == TAG_COMPONENTS)
+        return componentType(static_cast<Patch *>(nodeOf(index))->obj(), index.row());
+    return (ComponentType) (tag - TAG_COMPONENT);
+}
+
+
 Node::Node(Node *parent)
 {
     _parent = parent;
+    _row = 0;
     if (parent)
         parent->addChild(this);
 }
@@ -33,15 +106,14 @@ Node::Node(Node *parent)
 
 Node::~Node()
 {
+    // Patches belong to the arena of their file
     for (auto c : _children)
     {
         switch (c->type())
         {
         case NT_ROOT: delete static_cast<Node *>(c); break;
         case NT_FILE: delete static_cast<File *>(c); break;
-        case NT_PATCH: delete static_cast<Patch *>(c); break;
-        case NT_COMPONENTS: delete static_cast<Components *>(c); break;
-        case NT_COMPONENT: delete static_cast<Component *>(c); break;
+        default: break;
         }
     }
 }
@@ -49,6 +121,7 @@ Node::~Node()
 
 void Node::addChild(Node *child)
 {
+    child->_row = _children.size();
     _children.push_back(child);
 }
 
@@ -61,16 +134,7 @@ Node *Node::getChild(int idx)
 
 int Node::indexOfChild(Node *child)
 {
-    for (int i = 0; i < _children.size(); i++)
-        if (_children[i] == child)
-            return i;
-    return -1;
-}
-
-
-int Node::indexInParent()
-{
-    return _parent->indexOfChild(this);
+    return child->_parent == this ? child->_row : -1;
 }
 
 
@@ -82,6 +146,10 @@ int Node::nChildren()
 
 File::File(QString fn, Node *parent)
     : Node(parent)
+    , _nSelected(0)
+    , _nFullySelected(0)
+    , _nFullyVisible(0)
+    , _nInvisible(0)
     , _change(FC_NONE)
     , lastCheckedSize(0)
 {
@@ -142,13 +210,22 @@ void File::checkChange()
 }
 
 
+File::~File()
+{
+    clearPatches();
+}
+
+
+Patch *File::addPatch(DisplayObject *obj)
+{
+    return patches.create(obj, this);
+}
+
+
 void File::clearPatches()
 {
-    while (!_children.empty())
-    {
-        delete static_cast<Patch *>(_children.back());
-        _children.pop_back();
-    }
+    patches.clear();
+    _children.clear();
 }
 
 
@@ -189,89 +266,63 @@ void File::computeChecksums(std::vector<size_t> *ret)
 Patch::Patch(DisplayObject *obj, Node *parent)
     : Node(parent)
     , _obj(obj)
+    , selected(false)
+    , fullySelected(false)
+    , fullyVisible(false)
+    , invisible(false)
 {
     obj->setPatch(this);
-
-    if (obj->nFaces() > 0)
-    {
-        Components *faces = new Components(CT_FACE, this);
-        for (int i = 0; i < obj->nFaces(); i++)
-            new Component(i, faces);
-    }
-
-    if (obj->nEdges() > 0)
-    {
-        Components *edges = new Components(CT_EDGE, this);
-        for (int i = 0; i < obj->nEdges(); i++)
-            new Component(i, edges);
-    }
-
-    if (obj->nPoints() > 0)
-    {
-        Components *points = new Components(CT_POINT, this);
-        for (int i = 0; i < obj->nPoints(); i++)
-            new Component(i, points);
-    }
 }
 
 
 Patch::~Patch()
 {
-    delete _obj;
-}
-
-
-QString Patch::displayString()
-{
-    return QString("Patch %1").arg(indexInParent() + 1);
-}
+    File *file = static_cast<File *>(_parent);
+    file->_nSelected -= selected;
+    file->_nFullySelected -= fullySelected;
+    file->_nFullyVisible -= fullyVisible;
+    file->_nInvisible -= invisible;
 
-
-Components::Components(ComponentType type, Node *parent)
-    : Node(parent)
-    , _type(type)
-{
+    delete _obj;
 }
 
 
-QString Components::displayString()
+int Patch::refresh(SelectionMode mode)
 {
-    return (_type == CT_FACE ? "Faces" : (_type == CT_EDGE ? "Edges" : "Vertices"));
-}
+    bool wasSelected = selected;
 
+    File *file = static_cast<File *>(_parent);
+    file->_nSelected -= selected;
+    file->_nFullySelected -= fullySelected;
+    file->_nFullyVisible -= fullyVisible;
+    file->_nInvisible -= invisible;
 
-Component::Component(uint index, Node *parent)
-    : Node(parent)
-    , _index(index)
-{
-}
+    selected = _obj->hasSelection();
+    fullySelected = _obj->fullSelection(mode);
+    fullyVisible = _obj->isFullyVisible(false);
+    invisible = _obj->isInvisible(false);
 
+    file->_nSelected += selected;
+    file->_nFullySelected += fullySelected;
+    file->_nFullyVisible += fullyVisible;
+    file->_nInvisible += invisible;
 
-QString Component::displayString()
-{
-    Components *p = static_cast<Components *>(_parent);
-    return (QString("%1 %2")
-            .arg(p->cType() == CT_FACE ? "Face" : (p->cType() == CT_EDGE ? "Edge" : "Vertex"))
-            .arg(_index + 1));
+    return (int) selected - (int) wasSelected;
 }
 
 
-bool Component::isSelected()
+QString Patch::displayString()
 {
-    DisplayObject *obj = static_cast<Patch *>(_parent->parent())->obj();
-
-    switch (static_cast<Components *>(_parent)->cType())
-    {
-    case CT_FACE: return obj->faceSelected(_index);
-    case CT_EDGE: return obj->edgeSelected(_index);
-    case CT_POINT: return obj->pointSelected(_index);
-    }
+    return QString("Patch %1").arg(indexInParent() + 1);
 }
 
 
 ObjectSet::ObjectSet(QObject *parent)
     : QAbstractItemModel(parent)
     , _selectionMode(SM_PATCH)
+    , _selectAcross(true)
+    , nSelected(0)
+    , matchMode(SM_PATCH)
     , watch(true)
 {
     root = new Node();
@@ -351,12 +402,7 @@ void ObjectSet::watchFiles()
 bool ObjectSet::hasSelection()
 {
     DisplayObject::m.lock();
-
-    bool ret = any_of(DisplayObject::begin(), DisplayObject::end(),
-                      [] (std::pair<const uint, DisplayObject *> &i) {
-                          return i.second->hasSelection();
-                      });
-
+    bool ret = nSelected > 0;
     DisplayObject::m.unlock();
 
     return ret;
@@ -368,36 +414,207 @@ void ObjectSet::setSelectionMode(SelectionMode mode)
     if (mode != _selectionMode)
     {
         std::lock(m, DisplayObject::m);
+        beginChange();
+        switchMode(mode);
+        endChange();
+        flushChanges();
 
-        _selectionMode = mode;
+        m.unlock();
+        DisplayObject::m.unlock();
+    }
 
-        for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
-            i->second->selectionMode(mode, true);
+    emit selectionChanged();
+    emit selectionModeChanged(_selectionMode);
+}
 
-        for (auto f : root->children())
-            for (auto p : f->children())
-                signalCheckChange(static_cast<Patch *>(p));
 
+void ObjectSet::switchMode(SelectionMode mode)
+{
+    _selectionMode = mode;
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+    {
+        touch(i->second);
+        i->second->selectionMode(mode, true);
+    }
+
+    for (auto f : root->children())
+        for (auto p : f->children())
+            signalCheckChange(static_cast<Patch *>(p));
+}
+
+
+void ObjectSet::invertSelection()
+{
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+    {
+        touch(i->second);
+        i->second->invertSelection(_selectionMode);
+        signalCheckChange(i->second->patch());
+    }
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit selectionChanged();
+}
+
+
+void ObjectSet::undo()
+{
+    std::lock(m, DisplayObject::m);
+
+    if (undoStack.empty())
+    {
+        m.unlock();
+        DisplayObject::m.unlock();
+        return;
+    }
+
+    redoStack.push_back(undoStack.back());
+    undoStack.pop_back();
+    applyChange(redoStack.back(), redoStack.back().modeBefore);
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit historyChanged(canUndo(), canRedo());
+    emit selectionChanged();
+    emit selectionModeChanged(_selectionMode);
+    emit update();
+}
+
+
+void ObjectSet::redo()
+{
+    std::lock(m, DisplayObject::m);
+
+    if (redoStack.empty())
+    {
         m.unlock();
         DisplayObject::m.unlock();
+        return;
     }
 
+    undoStack.push_back(redoStack.back());
+    redoStack.pop_back();
+    applyChange(undoStack.back(), undoStack.back().modeAfter);
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit historyChanged(canUndo(), canRedo());
     emit selectionChanged();
     emit selectionModeChanged(_selectionMode);
+    emit update();
+}
+
+
+void ObjectSet::selectConnected()
+{
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    std::set<uint> selected;
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+        if (i->second->hasSelection())
+            selected.insert(i->first);
+
+    for (auto index : topology.connected(selected))
+    {
+        DisplayObject *obj = DisplayObject::getObject(index);
+        if (!obj)
+            continue;
+
+        touch(obj);
+        obj->selectObject(_selectionMode, true);
+        signalCheckChange(obj->patch());
+    }
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit selectionChanged();
+}
+
+
+void ObjectSet::selectInterfaces()
+{
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    // With a selection, only the interfaces of the selected patches are added
+    bool restrict = nSelected > 0;
+
+    std::vector<DisplayObject *> objects;
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+        if (!restrict || i->second->hasSelection())
+            objects.push_back(i->second);
+
+    std::set<Patch *> changedPatches;
+    for (auto obj : objects)
+    {
+        if (_selectionMode == SM_PATCH)
+        {
+            // Patches touching another patch anywhere
+            for (uint p = 0; p < obj->nPoints(); p++)
+                if (topology.shared(SM_POINT, obj->index(), p))
+                {
+                    touch(obj);
+                    obj->selectObject(SM_PATCH, true);
+                    changedPatches.insert(obj->patch());
+                    break;
+                }
+            continue;
+        }
+
+        uint n = _selectionMode == SM_FACE ? obj->nFaces() :
+                 _selectionMode == SM_EDGE ? obj->nEdges() : obj->nPoints();
+        for (uint c = 0; c < n; c++)
+            if (topology.shared(_selectionMode, obj->index(), c))
+                selectComponent(obj, c, true, &changedPatches);
+    }
+
+    for (auto p : changedPatches)
+        signalCheckChange(p);
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit selectionChanged();
 }
 
 
 void ObjectSet::showSelected(bool visible)
 {
     std::lock(m, DisplayObject::m);
+    beginChange();
 
     for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
         if (i->second->hasSelection())
         {
+            touch(i->second);
             i->second->showSelected(_selectionMode, visible);
             signalVisibleChange(i->second->patch());
         }
     
+    endChange();
+    flushChanges();
+
     m.unlock();
     DisplayObject::m.unlock();
 
@@ -408,14 +625,19 @@ void ObjectSet::showSelected(bool visible)
 void ObjectSet::showAllSelectedPatches(bool visible)
 {
     std::lock(m, DisplayObject::m);
+    beginChange();
 
     for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
         if (i->second->hasSelection())
         {
+            touch(i->second);
             i->second->showSelected(SM_PATCH, visible);
             signalVisibleChange(i->second->patch());
         }
 
+    endChange();
+    flushChanges();
+
     m.unlock();
     DisplayObject::m.unlock();
 
@@ -426,13 +648,18 @@ void ObjectSet::showAllSelectedPatches(bool visible)
 void ObjectSet::showAll()
 {
     std::lock(m, DisplayObject::m);
+    beginChange();
 
     for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
     {
+        touch(i->second);
         i->second->showSelected(SM_PATCH, true);
         signalVisibleChange(i->second->patch());
     }
 
+    endChange();
+    flushChanges();
+
     m.unlock();
     DisplayObject::m.unlock();
 
@@ -445,8 +672,20 @@ QModelIndex ObjectSet::index(int row, int column, const QModelIndex &parent) con
     if (!hasIndex(row, column, parent))
         return QModelIndex();
 
-    Node *parentNode = parent.isValid() ? static_cast<Node *>(parent.internalPointer()) : root;
-    return createIndex(row, column, parentNode->getChild(row));
+    if (!parent.isValid())
+        return createIndex(row, column, root->getChild(row));
+
+    Node *parentNode = nodeOf(parent);
+
+    switch (typeOf(parent))
+    {
+    case NT_PATCH:
+        return createIndex(row, column, tagged(parentNode, TAG_COMPONENTS));
+    case NT_COMPONENTS:
+        return createIndex(row, column, tagged(parentNode, TAG_COMPONENT + componentTypeOf(parent)));
+    default:
+        return createIndex(row, column, parentNode->getChild(row));
+    }
 }
 
 
@@ -455,7 +694,23 @@ QModelIndex ObjectSet::parent(const QModelIndex &index) const
     if (!index.isValid())
         return QModelIndex();
 
-    Node *parentNode = static_cast<Node *>(index.internalPointer())->parent();
+    Node *node = nodeOf(index);
+
+    switch (typeOf(index))
+    {
+    case NT_COMPONENTS:
+        return createIndex(node->indexInParent(), 0, node);
+    case NT_COMPONENT:
+    {
+        ComponentType type = componentTypeOf(index);
+        return createIndex(componentRow(static_cast<Patch *>(node)->obj(), type), 0,
+                           tagged(node, TAG_COMPONENTS));
+    }
+    default:
+        break;
+    }
+
+    Node *parentNode = node->parent();
 
     if (parentNode == root)
         return QModelIndex();
@@ -469,8 +724,23 @@ int ObjectSet::rowCount(const QModelIndex &index) const
     if (index.column() > 0)
         return 0;
 
-    Node *parentNode = index.isValid() ? static_cast<Node *>(index.internalPointer()) : root;
-    return parentNode->nChildren();
+    if (!index.isValid())
+        return root->nChildren();
+
+    Node *node = nodeOf(index);
+
+    switch (typeOf(index))
+    {
+    case NT_PATCH:
+        // The rows of all the component types the object has
+        return componentRow(static_cast<Patch *>(node)->obj(), CT_POINT + 1);
+    case NT_COMPONENTS:
+        return nComponents(static_cast<Patch *>(node)->obj(), componentTypeOf(index));
+    case NT_COMPONENT:
+        return 0;
+    default:
+        return node->nChildren();
+    }
 }
 
 
@@ -503,42 +773,47 @@ QVariant ObjectSet::data(const QModelIndex &index, int role) const
     if (!index.isValid())
         return QVariant();
 
-    Node *node = static_cast<Node *>(index.internalPointer());
+    Node *node = nodeOf(index);
+    NodeType type = typeOf(index);
 
     if (role == Qt::DisplayRole && index.column() == 0)
+    {
+        if (type == NT_COMPONENTS)
+        {
+            ComponentType cType = componentTypeOf(index);
+            return QString(cType == CT_FACE ? "Faces" : (cType == CT_EDGE ? "Edges" : "Vertices"));
+        }
+        else if (type == NT_COMPONENT)
+        {
+            ComponentType cType = componentTypeOf(index);
+            return (QString("%1 %2")
+                    .arg(cType == CT_FACE ? "Face" : (cType == CT_EDGE ? "Edge" : "Vertex"))
+                    .arg(index.row() + 1));
+        }
+
         return node->displayString();
+    }
 
     if (role == Qt::ForegroundRole && index.column() == 0)
     {
-        ComponentType type;
-        if (node->type() == NT_COMPONENTS)
-            type = static_cast<Components *>(node)->cType();
-        else if (node->type() == NT_COMPONENT)
-            type = static_cast<Components *>(node->parent())->cType();
-        else
+        if (type != NT_COMPONENTS && type != NT_COMPONENT)
             return QVariant();
 
-        return QBrush(QColor(modeMatch(_selectionMode, type) ? "black" : "silver"));
+        return QBrush(QColor(modeMatch(_selectionMode, componentTypeOf(index)) ? "black" : "silver"));
     }
 
     if (role == Qt::CheckStateRole && index.column() == 2)
     {
-        switch (node->type())
+        switch (type)
         {
         case NT_FILE:
         {
-            bool foundUnselected = false, foundSelected = false;
-            for (auto n : node->children())
-            {
-                DisplayObject *obj = static_cast<Patch *>(n)->obj();
-
-                foundUnselected |= !obj->fullSelection(_selectionMode);
-                foundSelected |= obj->hasSelection();
-
-                if (foundUnselected && foundSelected)
-                    return Qt::PartiallyChecked;
-            }
+            File *file = static_cast<File *>(node);
+            bool foundUnselected = file->nFullySelected() < file->nChildren();
+            bool foundSelected = file->nSelected() > 0;
 
+            if (foundUnselected && foundSelected)
+                return Qt::PartiallyChecked;
             return foundSelected ? Qt::Checked : Qt::Unchecked;
         }
         case NT_PATCH:
@@ -548,15 +823,18 @@ QVariant ObjectSet::data(const QModelIndex &index, int role) const
                             (obj->hasSelection() ? Qt::PartiallyChecked : Qt::Unchecked));
         }
         case NT_COMPONENT:
-            if (modeMatch(_selectionMode, static_cast<Components *>(node->parent())->cType()))
-                return static_cast<Component *>(node)->isSelected() ? Qt::Checked : Qt::Unchecked;
+            if (modeMatch(_selectionMode, componentTypeOf(index)))
+                return (static_cast<Patch *>(node)->obj()->selected(_selectionMode).test(index.row())
+                        ? Qt::Checked : Qt::Unchecked);
             return QVariant();
+        default:
+            break;
         }
     }
 
     if (role == Qt::DecorationRole && index.column() == 1)
     {
-        if (node->type() == NT_PATCH)
+        if (type == NT_PATCH)
         {
             DisplayObject *obj = static_cast<Patch *>(node)->obj();
             QString base = ":/icons/%1_%2.png";
@@ -572,20 +850,14 @@ QVariant ObjectSet::data(const QModelIndex &index, int role) const
                             (obj->isInvisible(false) ? "hidden" : "partial"));
             return QIcon(base);
         }
-        else if (node->type() == NT_FILE)
+        else if (type == NT_FILE)
         {
-            bool allInvisible = true, allVisible = true;
-            for (auto n : node->children())
-            {
-                DisplayObject *obj = static_cast<Patch *>(n)->obj();
-
-                allInvisible &= obj->isInvisible(false);
-                allVisible &= obj->isFullyVisible(false);
+            File *file = static_cast<File *>(node);
+            bool allInvisible = file->nInvisible() == file->nChildren();
+            bool allVisible = file->nFullyVisible() == file->nChildren();
 
-                if (!allInvisible && !allVisible)
-                    return QIcon(":/icons/file_partial.png");
-            }
-            
+            if (!allInvisible && !allVisible)
+                return QIcon(":/icons/file_partial.png");
             return QIcon(allVisible ? ":/icons/file_full.png" : ":/icons/file_hidden.png");
         }
     }
@@ -598,10 +870,15 @@ bool ObjectSet::setData(const QModelIndex &index, const QVariant &value, int rol
 {
     if (role == Qt::CheckStateRole)
     {
-        if (value.toInt() == Qt::Checked)
-            addToSelection(static_cast<Node *>(index.internalPointer()));
+        bool checked = value.toInt() == Qt::Checked;
+
+        if (typeOf(index) == NT_COMPONENT)
+            setComponentSelection(static_cast<Patch *>(nodeOf(index)), componentTypeOf(index),
+                                  index.row(), checked);
+        else if (checked)
+            addToSelection(nodeOf(index));
         else
-            removeFromSelection(static_cast<Node *>(index.internalPointer()));
+            removeFromSelection(nodeOf(index));
     }
 
     return false;
@@ -615,9 +892,7 @@ Qt::ItemFlags ObjectSet::flags(const QModelIndex &index) const
 
     Qt::ItemFlags flags = QAbstractItemModel::flags(index) & ~Qt::ItemIsSelectable;
 
-    Node *node = static_cast<Node *>(index.internalPointer());
-
-    switch (node->type())
+    switch (typeOf(index))
     {
     case NT_FILE:
         return flags | Qt::ItemIsUserCheckable;
@@ -627,6 +902,8 @@ Qt::ItemFlags ObjectSet::flags(const QModelIndex &index) const
         return flags & ~Qt::ItemIsSelectable;
     case NT_COMPONENT:
         return flags | Qt::ItemIsUserCheckable | Qt::ItemNeverHasChildren;
+    default:
+        return flags;
     }
 }
 
@@ -643,6 +920,21 @@ void ObjectSet::addPatchesFromFile(QString fileName)
     {
         std::lock(m, DisplayObject::m);
 
+        for (auto p : file->children())
+            topology.remove(static_cast<Patch *>(p)->obj());
+
+        // Object indices are reused, so old deltas could apply to the wrong patches
+        clearHistory();
+
+        nSelected -= file->nSelected();
+
+        searchIndex.remove(file);
+        matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                     [file] (const SearchIndex::match &match) {
+                                         return match.patch->parent() == file;
+                                     }),
+                      matches.end());
+
         beginRemoveRows(createIndex(file->indexInParent(), 0, file), 0, file->nChildren() - 1);
         file->clearPatches();
         endRemoveRows();
@@ -678,6 +970,8 @@ void ObjectSet::addPatchesFromFile(QString fileName)
     emit log(QString("Closed file '%1' (read %2 patches)")
              .arg(file->fn())
              .arg(file->nChildren()));
+
+    addToTopology(file);
 }
 
 
@@ -753,7 +1047,9 @@ bool ObjectSet::addPatchFromStream(std::ifstream &stream, File *file)
     m.lock();
     QModelIndex index = createIndex(file->indexInParent(), 0, file);
     beginInsertRows(index, file->nChildren(), file->nChildren());
-    Patch *patch = new Patch(obj, file);
+    Patch *patch = file->addPatch(obj);
+    nSelected += patch->refresh(_selectionMode);
+    searchIndex.add(patch);
     endInsertRows();
     m.unlock();
 
@@ -790,10 +1086,7 @@ void ObjectSet::boundingSphere(QVector3D *center, float *radius)
         return;
     }
 
-    bool hasSelection = any_of(DisplayObject::begin(), DisplayObject::end(),
-                               [] (std::pair<const uint, DisplayObject *> &i) {
-                                   return i.second->hasSelection();
-                               });
+    bool hasSelection = nSelected > 0;
 
     DisplayObject *a = DisplayObject::begin()->second, *b;
     farthestPointFrom(a, &b, hasSelection);
@@ -818,11 +1111,13 @@ void ObjectSet::boundingSphere(QVector3D *center, float *radius)
 void ObjectSet::setSelection(std::set<std::pair<uint,uint>> *picks, bool clear)
 {
     std::lock(m, DisplayObject::m);
+    beginChange();
 
     if (clear)
         for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
             if (i->second->hasSelection())
             {
+                touch(i->second);
                 i->second->selectObject(_selectionMode, false);
                 signalCheckChange(i->second->patch());
             }
@@ -835,21 +1130,23 @@ void ObjectSet::setSelection(std::set<std::pair<uint,uint>> *picks, bool clear)
         if (!obj)
             continue;
 
-        if (obj->patch())
-            changedPatches.insert(obj->patch());
-
-        switch (_selectionMode)
+        if (_selectionMode == SM_PATCH)
         {
-        case SM_PATCH: obj->selectObject(SM_PATCH, true); break;
-        case SM_FACE: obj->selectFaces(true, {p.second}); break;
-        case SM_EDGE: obj->selectEdges(true, {p.second}); break;
-        case SM_POINT: obj->selectPoints(true, {p.second}); break;
+            touch(obj);
+            obj->selectObject(SM_PATCH, true);
+            if (obj->patch())
+                changedPatches.insert(obj->patch());
         }
+        else
+            selectComponent(obj, p.second, true, &changedPatches);
     }
 
     for (auto p : changedPatches)
         signalCheckChange(p);
 
+    endChange();
+    flushChanges();
+
     m.unlock();
     DisplayObject::m.unlock();
 
@@ -857,50 +1154,332 @@ void ObjectSet::setSelection(std::set<std::pair<uint,uint>> *picks, bool clear)
 }
 
 
-void ObjectSet::addToSelection(Node *node, bool signal, bool lock)
+void ObjectSet::selectByQuery(Query &query, bool clear)
 {
-    if (lock)
-        std::lock(m, DisplayObject::m);
+    DisplayObject::m.lock();
+    std::set<std::pair<uint,uint>> picks = query.run(_selectionMode);
+    DisplayObject::m.unlock();
 
-    if (node->type() == NT_FILE)
-    {
-        for (auto n : node->children())
-            addToSelection(n, false, false);
-    }
-    else if (node->type() == NT_PATCH)
+    static const char *names[] = {"patches", "faces", "edges", "vertices"};
+    emit log(QString("Query matched %1 %2").arg(picks.size()).arg(names[_selectionMode]));
+
+    setSelection(&picks, clear);
+}
+
+
+uint ObjectSet::search(QString query)
+{
+    m.lock();
+    matches = searchIndex.find(query, &matchMode);
+    uint n = matches.size();
+    m.unlock();
+
+    return n;
+}
+
+
+QModelIndex ObjectSet::matchIndex(uint i)
+{
+    m.lock();
+
+    QModelIndex index;
+    if (i < matches.size())
     {
-        Patch *patch = static_cast<Patch *>(node);
-        patch->obj()->selectObject(_selectionMode, true);
+        Patch *patch = matches[i].patch;
+        if (matchMode == SM_PATCH)
+            index = createIndex(patch->indexInParent(), 0, patch);
+        else
+            index = createIndex(matches[i].component, 0,
+                                tagged(patch, TAG_COMPONENT + matchMode - SM_FACE));
+    }
 
-        signalCheckChange(patch);
+    m.unlock();
+    return index;
+}
+
+
+void ObjectSet::selectMatches()
+{
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    SelectionMode oldMode = _selectionMode;
+    if (matchMode != SM_PATCH && matchMode != _selectionMode)
+        switchMode(matchMode);
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+        if (i->second->hasSelection())
+        {
+            touch(i->second);
+            i->second->selectObject(_selectionMode, false);
+            signalCheckChange(i->second->patch());
+        }
+
+    // Whole patches are selected in the current mode, like checking them in the tree
+    std::set<Patch *> changedPatches;
+    for (auto &match : matches)
+    {
+        if (matchMode == SM_PATCH)
+        {
+            touch(match.patch->obj());
+            match.patch->obj()->selectObject(_selectionMode, true);
+            changedPatches.insert(match.patch);
+        }
+        else
+            selectComponent(match.patch->obj(), match.component, true, &changedPatches);
     }
-    else if (node->type() == NT_COMPONENT)
+
+    for (auto p : changedPatches)
+        signalCheckChange(p);
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    if (_selectionMode != oldMode)
+        emit selectionModeChanged(_selectionMode);
+
+    emit selectionChanged();
+}
+
+
+void ObjectSet::showOnlyMatches()
+{
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    std::set<Patch *> matched;
+    for (auto &match : matches)
+        matched.insert(match.patch);
+
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
     {
-        ComponentType type = static_cast<Components *>(node->parent())->cType();
+        Patch *patch = i->second->patch();
+        touch(i->second);
+        i->second->showSelected(SM_PATCH, matched.find(patch) != matched.end());
+        signalVisibleChange(patch);
+    }
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
 
-        if (modeMatch(_selectionMode, type))
+    emit update();
+}
+
+
+void ObjectSet::storeSelectionSet(QString name)
+{
+    SelectionSet set(name);
+
+    std::lock(m, DisplayObject::m);
+
+    for (auto f : root->children())
+        for (auto p : f->children())
         {
-            Patch *patch = static_cast<Patch *>(node->parent()->parent());
+            DisplayObject *obj = static_cast<Patch *>(p)->obj();
+            if (!obj->hasSelection())
+                continue;
 
-            switch (type)
+            SelectionSet::entry e;
+            e.file = static_cast<File *>(f)->absolute();
+            e.patch = p->indexInParent();
+            e.mode = _selectionMode;
+
+            if (_selectionMode != SM_PATCH)
             {
-            case CT_FACE:
-                patch->obj()->selectFaces(true, {static_cast<Component *>(node)->index()});
-                break;
-            case CT_EDGE:
-                patch->obj()->selectEdges(true, {static_cast<Component *>(node)->index()});
-                break;
-            case CT_POINT:
-                patch->obj()->selectPoints(true, {static_cast<Component *>(node)->index()});
-                break;
+                const BitSet &selected = obj->selected(_selectionMode);
+                e.indices.reserve(selected.size());
+                for (auto i : selected)
+                    e.indices.push_back(i);
             }
 
-            signalCheckChange(patch);
+            set.entries.push_back(e);
         }
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    auto it = std::find_if(selectionSets.begin(), selectionSets.end(),
+                           [name] (const SelectionSet &s) { return s.name == name; });
+    if (it != selectionSets.end())
+        *it = set;
+    else
+        selectionSets.push_back(set);
+
+    emit log(QString("Stored selection set '%1' (%2 components)").arg(name).arg(set.nComponents()));
+    emit selectionSetsChanged();
+}
+
+
+void ObjectSet::applySelectionSet(QString name, bool clear)
+{
+    auto it = std::find_if(selectionSets.begin(), selectionSets.end(),
+                           [name] (const SelectionSet &s) { return s.name == name; });
+    if (it == selectionSets.end())
+        return;
+
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    // Sets are stored in a single mode, switched to as part of the same change
+    SelectionMode oldMode = _selectionMode;
+    if (!it->entries.empty() && it->entries[0].mode != _selectionMode)
+        switchMode(it->entries[0].mode);
+
+    if (clear)
+        for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+            if (i->second->hasSelection())
+            {
+                touch(i->second);
+                i->second->selectObject(_selectionMode, false);
+                signalCheckChange(i->second->patch());
+            }
+
+    std::map<QString, Node *> files;
+    for (auto f : root->children())
+        files[static_cast<File *>(f)->absolute()] = f;
+
+    uint nMissing = 0;
+    for (auto &e : it->entries)
+    {
+        auto file = files.find(e.file);
+        if (file == files.end() || e.patch >= (uint) file->second->nChildren() || e.mode != _selectionMode)
+        {
+            nMissing++;
+            continue;
+        }
+
+        Patch *patch = static_cast<Patch *>(file->second->getChild(e.patch));
+        DisplayObject *obj = patch->obj();
+
+        uint n = e.mode == SM_FACE ? obj->nFaces() : e.mode == SM_EDGE ? obj->nEdges() : obj->nPoints();
+        if (e.mode != SM_PATCH && !e.indices.empty() && *std::max_element(e.indices.begin(), e.indices.end()) >= n)
+        {
+            nMissing++;
+            continue;
+        }
+
+        touch(obj);
+        switch (e.mode)
+        {
+        case SM_PATCH: obj->selectObject(SM_PATCH, true); break;
+        case SM_FACE: obj->selectFaces(true, e.indices); break;
+        case SM_EDGE: obj->selectEdges(true, e.indices); break;
+        case SM_POINT: obj->selectPoints(true, e.indices); break;
+        }
+
+        signalCheckChange(patch);
+    }
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    if (nMissing > 0)
+        emit log(QString("Skipped %1 entries of selection set '%2' that do not match the loaded patches")
+                 .arg(nMissing).arg(name), LL_WARNING);
+
+    if (_selectionMode != oldMode)
+        emit selectionModeChanged(_selectionMode);
+
+    emit selectionChanged();
+}
+
+
+void ObjectSet::removeSelectionSet(QString name)
+{
+    selectionSets.erase(std::remove_if(selectionSets.begin(), selectionSets.end(),
+                                       [name] (const SelectionSet &s) { return s.name == name; }),
+                        selectionSets.end());
+
+    emit selectionSetsChanged();
+}
+
+
+std::vector<QString> ObjectSet::selectionSetNames()
+{
+    std::vector<QString> names;
+    for (auto &set : selectionSets)
+        names.push_back(set.name);
+    return names;
+}
+
+
+bool ObjectSet::saveSelectionSets(QString fileName, SetFormat format)
+{
+    QString error;
+    if (!SelectionSet::save(selectionSets, fileName, format, &error))
+    {
+        emit log(QString("Failed to save selection sets to '%1': %2").arg(fileName).arg(error), LL_ERROR);
+        return false;
+    }
+
+    emit log(QString("Saved %1 selection sets to '%2'").arg(selectionSets.size()).arg(fileName));
+    return true;
+}
+
+
+bool ObjectSet::loadSelectionSets(QString fileName)
+{
+    std::vector<SelectionSet> sets;
+    QString error;
+    if (!SelectionSet::load(&sets, fileName, &error))
+    {
+        emit log(QString("Failed to load selection sets from '%1': %2").arg(fileName).arg(error), LL_ERROR);
+        return false;
+    }
+
+    // Sets with the same name as an existing one replace it
+    for (auto &set : sets)
+    {
+        auto it = std::find_if(selectionSets.begin(), selectionSets.end(),
+                               [&set] (const SelectionSet &s) { return s.name == set.name; });
+        if (it != selectionSets.end())
+            *it = set;
+        else
+            selectionSets.push_back(set);
+    }
+
+    emit log(QString("Loaded %1 selection sets from '%2'").arg(sets.size()).arg(fileName));
+    emit selectionSetsChanged();
+    return true;
+}
+
+
+void ObjectSet::addToSelection(Node *node, bool signal, bool lock)
+{
+    if (lock)
+    {
+        std::lock(m, DisplayObject::m);
+        beginChange();
+    }
+
+    if (node->type() == NT_FILE)
+    {
+        for (auto n : node->children())
+            addToSelection(n, false, false);
+    }
+    else if (node->type() == NT_PATCH)
+    {
+        Patch *patch = static_cast<Patch *>(node);
+        touch(patch->obj());
+        patch->obj()->selectObject(_selectionMode, true);
+
+        signalCheckChange(patch);
     }
 
     if (lock)
     {
+        endChange();
+        flushChanges();
+
         m.unlock();
         DisplayObject::m.unlock();
     }
@@ -913,7 +1492,10 @@ void ObjectSet::addToSelection(Node *node, bool signal, bool lock)
 void ObjectSet::removeFromSelection(Node *node, bool signal, bool lock)
 {
     if (lock)
+    {
         std::lock(m, DisplayObject::m);
+        beginChange();
+    }
 
     if (node->type() == NT_FILE)
     {
@@ -923,36 +1505,17 @@ void ObjectSet::removeFromSelection(Node *node, bool signal, bool lock)
     else if (node->type() == NT_PATCH)
     {
         Patch *patch = static_cast<Patch *>(node);
+        touch(patch->obj());
         patch->obj()->selectObject(_selectionMode, false);
 
         signalCheckChange(patch);
     }
-    else if (node->type() == NT_COMPONENT)
-    {
-        ComponentType type = static_cast<Components *>(node->parent())->cType();
-        if (modeMatch(_selectionMode, type))
-        {
-            Patch *patch = static_cast<Patch *>(node->parent()->parent());
-
-            switch (type)
-            {
-            case CT_FACE:
-                patch->obj()->selectFaces(false, {static_cast<Component *>(node)->index()});
-                break;
-            case CT_EDGE:
-                patch->obj()->selectEdges(false, {static_cast<Component *>(node)->index()});
-                break;
-            case CT_POINT:
-                patch->obj()->selectPoints(false, {static_cast<Component *>(node)->index()});
-                break;
-            }
-
-            signalCheckChange(patch);
-        }
-    }
 
     if (lock)
     {
+        endChange();
+        flushChanges();
+
         m.unlock();
         DisplayObject::m.unlock();
     }
@@ -962,6 +1525,59 @@ void ObjectSet::removeFromSelection(Node *node, bool signal, bool lock)
 }
 
 
+void ObjectSet::setComponentSelection(Patch *patch, ComponentType type, uint component, bool selected)
+{
+    if (!modeMatch(_selectionMode, type))
+        return;
+
+    std::lock(m, DisplayObject::m);
+    beginChange();
+
+    std::set<Patch *> changedPatches;
+    selectComponent(patch->obj(), component, selected, &changedPatches);
+
+    for (auto p : changedPatches)
+        signalCheckChange(p);
+
+    endChange();
+    flushChanges();
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    emit selectionChanged();
+}
+
+
+void ObjectSet::selectComponent(DisplayObject *obj, uint component, bool selected, std::set<Patch *> *changed)
+{
+    std::vector<std::pair<uint,uint>> targets;
+    if (_selectAcross)
+        targets = topology.coincident(_selectionMode, obj->index(), component);
+    else
+        targets = {std::make_pair(obj->index(), component)};
+
+    for (auto &t : targets)
+    {
+        DisplayObject *target = DisplayObject::getObject(t.first);
+        if (!target)
+            continue;
+
+        touch(target);
+        switch (_selectionMode)
+        {
+        case SM_FACE: target->selectFaces(selected, {t.second}); break;
+        case SM_EDGE: target->selectEdges(selected, {t.second}); break;
+        case SM_POINT: target->selectPoints(selected, {t.second}); break;
+        default: break;
+        }
+
+        if (target->patch())
+            changed->insert(target->patch());
+    }
+}
+
+
 File *ObjectSet::getOrCreateFileNode(QString fileName)
 {
     File *node = NULL;
@@ -1029,35 +1645,192 @@ void ObjectSet::ritterSphere(QVector3D *center, float *radius, bool hasSelection
 }
 
 
-void ObjectSet::signalCheckChange(Patch *patch)
+void ObjectSet::addToTopology(File *file)
 {
-    for (Node *n : patch->children())
+    std::lock(m, DisplayObject::m);
+
+    uint nInterior = 0;
+    for (auto p : file->children())
+        nInterior += topology.add(static_cast<Patch *>(p)->obj());
+
+    m.unlock();
+    DisplayObject::m.unlock();
+
+    if (nInterior > 0)
+        emit log(QString("Found %1 interior faces").arg(nInterior));
+
+    emit update();
+}
+
+
+void ObjectSet::beginChange()
+{
+    savedMode = _selectionMode;
+    savedStates.clear();
+}
+
+
+void ObjectSet::touch(DisplayObject *obj)
+{
+    // Only the first snapshot of a change is kept, as it holds the state before the change
+    if (savedStates.find(obj->index()) == savedStates.end())
+        savedStates[obj->index()] = obj->saveState();
+}
+
+
+void ObjectSet::endChange()
+{
+    change c;
+    c.modeBefore = savedMode;
+    c.modeAfter = _selectionMode;
+
+    for (auto &saved : savedStates)
     {
-        emit dataChanged(createIndex(0, 0, n->getChild(0)),
-                         createIndex(n->nChildren()-1, 0, n->getChild(n->nChildren()-1)),
-                         QVector<int>(Qt::ForegroundRole));
-        emit dataChanged(createIndex(0, 2, n->getChild(0)),
-                         createIndex(n->nChildren()-1, 2, n->getChild(n->nChildren()-1)),
-                         QVector<int>(Qt::CheckStateRole));
+        DisplayObject *obj = DisplayObject::getObject(saved.first);
+        if (!obj)
+            continue;
+
+        DisplayObject::delta d;
+        if (obj->diffState(saved.second, &d))
+            c.deltas[saved.first] = d;
     }
+    savedStates.clear();
 
-    emit dataChanged(createIndex(0, 0, patch->getChild(0)),
-                     createIndex(patch->nChildren()-1, 0, patch->getChild(patch->nChildren()-1)),
-                     QVector<int>(Qt::ForegroundRole));
+    if (c.deltas.empty() && c.modeBefore == c.modeAfter)
+        return;
 
-    QModelIndex patchIndex = createIndex(patch->indexInParent(), 2, patch);
-    emit dataChanged(patchIndex, patchIndex, QVector<int>(Qt::CheckStateRole));
+    undoStack.push_back(c);
+    if (undoStack.size() > HISTORY_DEPTH)
+        undoStack.erase(undoStack.begin());
+    redoStack.clear();
 
-    QModelIndex fileIndex = createIndex(patch->parent()->indexInParent(), 2, patch->parent());
-    emit dataChanged(fileIndex, fileIndex, QVector<int>(Qt::CheckStateRole));
+    emit historyChanged(canUndo(), canRedo());
+}
+
+
+void ObjectSet::applyChange(const change &c, SelectionMode mode)
+{
+    // Full selection depends on the mode, so every patch must be refreshed if it changes
+    if (mode != _selectionMode)
+    {
+        _selectionMode = mode;
+        for (auto f : root->children())
+            for (auto p : f->children())
+                signalCheckChange(static_cast<Patch *>(p));
+    }
+
+    for (auto &d : c.deltas)
+    {
+        DisplayObject *obj = DisplayObject::getObject(d.first);
+        if (!obj)
+            continue;
+
+        obj->toggleState(d.second);
+
+        if (obj->patch())
+        {
+            signalCheckChange(obj->patch());
+            signalVisibleChange(obj->patch());
+        }
+    }
+}
+
+
+void ObjectSet::clearHistory()
+{
+    undoStack.clear();
+    redoStack.clear();
+
+    emit historyChanged(false, false);
+}
+
+
+void ObjectSet::signalCheckChange(Patch *patch)
+{
+    if (!patch)
+        return;
+
+    nSelected += patch->refresh(_selectionMode);
+    checkDirty.insert(patch);
 }
 
 
 void ObjectSet::signalVisibleChange(Patch *patch)
 {
-    QModelIndex patchIndex = createIndex(patch->indexInParent(), 1, patch);
-    emit dataChanged(patchIndex, patchIndex, QVector<int>(Qt::DecorationRole));
+    if (!patch)
+        return;
+
+    nSelected += patch->refresh(_selectionMode);
+    visibleDirty.insert(patch);
+}
+
+
+void ObjectSet::flushChanges()
+{
+    std::set<Patch *> dirty(checkDirty);
+    dirty.insert(visibleDirty.begin(), visibleDirty.end());
+
+    // A single layout change is cheaper for the views than thousands of small updates
+    if (dirty.size() > MAX_DIRTY_PATCHES)
+    {
+        checkDirty.clear();
+        visibleDirty.clear();
+        emit layoutAboutToBeChanged();
+        emit layoutChanged();
+        return;
+    }
+
+    QVector<int> roles = {Qt::ForegroundRole, Qt::CheckStateRole, Qt::DecorationRole};
+
+    // The components of patches with changed selection, one signal per parent
+    for (auto patch : checkDirty)
+    {
+        DisplayObject *obj = patch->obj();
+        int nTypes = 0;
+
+        for (int t = CT_FACE; t <= CT_POINT; t++)
+        {
+            uint n = nComponents(obj, t);
+            if (n == 0)
+                continue;
+
+            emit dataChanged(createIndex(0, 0, tagged(patch, TAG_COMPONENT + t)),
+                             createIndex(n-1, 2, tagged(patch, TAG_COMPONENT + t)), roles);
+            nTypes++;
+        }
+
+        if (nTypes > 0)
+            emit dataChanged(createIndex(0, 0, tagged(patch, TAG_COMPONENTS)),
+                             createIndex(nTypes-1, 2, tagged(patch, TAG_COMPONENTS)), roles);
+    }
+
+    // The changed patch rows of each file, and the changed file rows, as one range each
+    std::map<Node *, std::pair<int,int>> patchRows;
+    for (auto patch : dirty)
+    {
+        int row = patch->indexInParent();
+        auto it = patchRows.find(patch->parent());
+        if (it == patchRows.end())
+            patchRows[patch->parent()] = std::make_pair(row, row);
+        else
+            it->second = std::make_pair(std::min(it->second.first, row), std::max(it->second.second, row));
+    }
+
+    int firstFile = root->nChildren(), lastFile = -1;
+    for (auto &rows : patchRows)
+    {
+        Node *file = rows.first;
+        emit dataChanged(createIndex(rows.second.first, 0, file->getChild(rows.second.first)),
+                         createIndex(rows.second.second, 2, file->getChild(rows.second.second)), roles);
+
+        firstFile = std::min(firstFile, file->indexInParent());
+        lastFile = std::max(lastFile, file->indexInParent());
+    }
+
+    if (lastFile >= 0)
+        emit dataChanged(createIndex(firstFile, 0, root->getChild(firstFile)),
+                         createIndex(lastFile, 2, root->getChild(lastFile)), roles);
 
-    QModelIndex fileIndex = createIndex(patch->parent()->indexInParent(), 1, patch->parent());
-    emit dataChanged(fileIndex, fileIndex, QVector<int>(Qt::DecorationRole));
+    checkDirty.clear();
+    visibleDirty.clear();
 }
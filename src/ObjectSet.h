@@ -1,4 +1,5 @@
 #include <fstream>
+#include <map>
 #include <mutex>
 #include <set>
 #include <string>
@@ -12,7 +13,12 @@
 #include <QString>
 #include <QVector3D>
 
+#include "Arena.h"
 #include "DisplayObject.h"
+#include "Query.h"
+#include "SearchIndex.h"
+#include "SelectionSet.h"
+#include "Topology.h"
 
 #ifndef _OBJECTSET_H_
 #define _OBJECTSET_H_
@@ -34,24 +40,30 @@ public:
     void addChild(Node *child);
     Node *getChild(int idx);
     int indexOfChild(Node *child);
-    int indexInParent();
     int nChildren();
 
     inline Node *parent() { return _parent; }
 
-    inline std::vector<Node *> children() { return _children; }
+    // The row of this node in its parent, set when it is added
+    inline int indexInParent() { return _row; }
+
+    inline const std::vector<Node *> &children() { return _children; }
 
 protected:
     Node *_parent;
+    int _row;
     std::vector<Node *> _children;
 };
 
 
+class Patch;
+
+
 class File : public Node
 {
 public:
     File(QString fn, Node *parent = NULL);
-    ~File() { }
+    ~File();
 
     NodeType type() { return NT_FILE; }
     QString displayString();
@@ -71,11 +83,25 @@ public:
     void checkChange();
     inline FileChange change() { return _change; }
 
+    // Patches are allocated together, and freed together when the file is reloaded
+    Patch *addPatch(DisplayObject *obj);
     void clearPatches();
 
+    // The number of patches with some selection, full selection, full visibility and no
+    // visibility, kept up to date by the patches
+    inline uint nSelected() { return _nSelected; }
+    inline uint nFullySelected() { return _nFullySelected; }
+    inline uint nFullyVisible() { return _nFullyVisible; }
+    inline uint nInvisible() { return _nInvisible; }
+
     std::mutex m;
 
 private:
+    friend class Patch;
+
+    uint _nSelected, _nFullySelected, _nFullyVisible, _nInvisible;
+    Arena<Patch> patches;
+
     QString fileName, absolutePath;
     std::vector<size_t> checksums;
     uint _size, lastCheckedSize;
@@ -98,43 +124,17 @@ public:
 
     inline DisplayObject *obj() { return _obj; }
 
-private:
-    DisplayObject *_obj;
-};
-
-
-class Components : public Node
-{
-public:
-    Components(ComponentType type, Node *parent = NULL);
-    ~Components() {};
-
-    virtual NodeType type () { return NT_COMPONENTS; }
-    virtual QString displayString();
-
-    inline ComponentType cType() { return _type; }
-
-private:
-    ComponentType _type;
-};
-
-
-class Component : public Node
-{
-public:
-
-    Component(uint index, Node *parent = NULL);
-    ~Component() {};
-
-    virtual NodeType type () { return NT_COMPONENT; }
-    virtual QString displayString();
+    inline bool isSelected() { return selected; }
+    inline bool isFullyVisible() { return fullyVisible; }
+    inline bool isInvisible() { return invisible; }
 
-    bool isSelected();
-
-    inline uint index() { return _index; }
+    // Updates the cached selection and visibility state, and the counters of the file. Returns
+    // the change in the number of patches with a selection.
+    int refresh(SelectionMode mode);
 
 private:
-    uint _index;
+    DisplayObject *_obj;
+    bool selected, fullySelected, fullyVisible, invisible;
 };
 
 
@@ -149,10 +149,20 @@ public:
     bool hasSelection();
     inline SelectionMode selectionMode() { return _selectionMode; }
     void setSelectionMode(SelectionMode mode);
+    void invertSelection();
+    void selectConnected();
+    void selectInterfaces();
+    inline bool selectAcross() { return _selectAcross; }
+    inline void setSelectAcross(bool val) { _selectAcross = val; }
     void showSelected(bool visible);
     void showAllSelectedPatches(bool visible);
     void showAll();
 
+    void undo();
+    void redo();
+    inline bool canUndo() { return !undoStack.empty(); }
+    inline bool canRedo() { return !redoStack.empty(); }
+
     std::mutex m;
 
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
@@ -167,6 +177,22 @@ public:
     void loadFile(QString fileName);
     void boundingSphere(QVector3D *center, float *radius);
     void setSelection(std::set<std::pair<uint,uint>> *picks, bool clear = true);
+    void selectByQuery(Query &query, bool clear = true);
+
+    void storeSelectionSet(QString name);
+    void applySelectionSet(QString name, bool clear = true);
+    void removeSelectionSet(QString name);
+    std::vector<QString> selectionSetNames();
+    bool saveSelectionSets(QString fileName, SetFormat format);
+    bool loadSelectionSets(QString fileName);
+
+    // Searches the tree (see SearchIndex) and keeps the matches for the functions below. Returns
+    // the number of matches.
+    uint search(QString query);
+    QModelIndex matchIndex(uint i);
+    void selectMatches();
+    void showOnlyMatches();
+
     void addToSelection(Node *node, bool signal = true, bool lock = true);
     void removeFromSelection(Node *node, bool signal = true, bool lock = true);
 
@@ -175,6 +201,8 @@ signals:
     void update();
     void selectionChanged();
     void selectionModeChanged(SelectionMode mode);
+    void historyChanged(bool canUndo, bool canRedo);
+    void selectionSetsChanged();
     void log(QString, LogLevel = LL_NORMAL);
 
 private:
@@ -182,6 +210,35 @@ private:
     File *getOrCreateFileNode(QString fileName);
 
     SelectionMode _selectionMode;
+    bool _selectAcross;
+    uint nSelected;
+    std::vector<SelectionSet> selectionSets;
+
+    SearchIndex searchIndex;
+    std::vector<SearchIndex::match> matches;
+    SelectionMode matchMode;
+    Topology topology;
+
+    // Undo and redo history of selection and visibility changes, stored as per-object deltas
+    typedef struct
+    {
+        SelectionMode modeBefore, modeAfter;
+        std::map<uint, DisplayObject::delta> deltas;
+    } change;
+
+    std::vector<change> undoStack, redoStack;
+    // The states of the objects touched by the current change, from before it
+    std::map<uint, DisplayObject::state> savedStates;
+    SelectionMode savedMode;
+
+    void beginChange();
+    // Must be called before an object is modified inside a change
+    void touch(DisplayObject *obj);
+    void endChange();
+    // Changes the selection mode without locking, inside a change
+    void switchMode(SelectionMode mode);
+    void applyChange(const change &c, SelectionMode mode);
+    void clearHistory();
     
     std::thread fileWatcher;
     bool watch;
@@ -192,8 +249,16 @@ private:
     void farthestPointFrom(DisplayObject *a, DisplayObject **b, bool hasSelection);
     void ritterSphere(QVector3D *center, float *radius, bool hasSelection);
 
+    void addToTopology(File *file);
+    void selectComponent(DisplayObject *obj, uint component, bool selected, std::set<Patch *> *changed);
+    void setComponentSelection(Patch *patch, ComponentType type, uint component, bool selected);
+
+    // Changed patches are collected during an operation, and the views are notified once at the
+    // end by flushChanges(), with the ranges merged
+    std::set<Patch *> checkDirty, visibleDirty;
     void signalCheckChange(Patch *patch);
     void signalVisibleChange(Patch *patch);
+    void flushChanges();
 
     void addPatchesFromFile(QString fileName);
     bool addPatchFromStream(std::ifstream &stream, File *file);
@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Picker.h"
+
+// Rectangles up to this size in pixels are treated as clicks and resolved by a single ray
+#define CLICK_SIZE 3
+
+// Edges and points are picked within this many pixels of the ray
+#define PICK_RADIUS 6.0
+
+// Relative depth slack used when testing whether a sample is hidden behind a face
+#define DEPTH_SLACK 1e-3
+
+
+BVH Picker::top;
+std::vector<DisplayObject *> Picker::topObjects;
+uint Picker::topGeneration = 0;
+
+
+static bool hitTriangle(QVector3D orig, QVector3D dir, QVector3D a, QVector3D b, QVector3D c, float *t)
+{
+    QVector3D e1 = b - a, e2 = c - a;
+    QVector3D p = QVector3D::crossProduct(dir, e2);
+    float det = QVector3D::dotProduct(e1, p);
+    if (det == 0.0)
+        return false;
+
+    QVector3D s = orig - a;
+    float u = QVector3D::dotProduct(s, p) / det;
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    QVector3D q = QVector3D::crossProduct(s, e1);
+    float v = QVector3D::dotProduct(dir, q) / det;
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    *t = QVector3D::dotProduct(e2, q) / det;
+    return *t >= 0.0;
+}
+
+
+static void closestOnSegment(QVector3D orig, QVector3D dir, QVector3D a, QVector3D b, float *t, float *dist)
+{
+    QVector3D u = b - a, w = orig - a;
+    float B = QVector3D::dotProduct(dir, u), C = QVector3D::dotProduct(u, u);
+    float D = QVector3D::dotProduct(dir, w), E = QVector3D::dotProduct(u, w);
+
+    float s = C - B*B > 0.0 ? (E - D*B) / (C - B*B) : 0.0;
+    s = std::min(std::max(s, 0.0f), 1.0f);
+    *t = s*B - D;
+
+    if (*t < 0.0)
+    {
+        *t = 0.0;
+        s = C > 0.0 ? std::min(std::max(-E / C, 0.0f), 1.0f) : 0.0;
+    }
+
+    *dist = (orig + *t * dir - a - s * u).length();
+}
+
+
+static bool inside(const std::vector<QVector4D> &planes, QVector3D p)
+{
+    for (auto &pl : planes)
+        if (QVector3D::dotProduct(pl.toVector3D(), p) + pl.w() < 0.0)
+            return false;
+    return true;
+}
+
+
+static bool outside(const std::vector<QVector4D> &planes, std::initializer_list<QVector3D> pts)
+{
+    for (auto &pl : planes)
+    {
+        bool out = true;
+        for (auto &p : pts)
+            if (QVector3D::dotProduct(pl.toVector3D(), p) + pl.w() >= 0.0)
+            {
+                out = false;
+                break;
+            }
+        if (out)
+            return true;
+    }
+    return false;
+}
+
+
+// Whether a triangle, or with two points a segment, overlaps the frustum. The points are clipped
+// against each plane in turn, and whatever remains is inside.
+static bool overlaps(const std::vector<QVector4D> &planes, std::vector<QVector3D> pts)
+{
+    for (auto &pl : planes)
+    {
+        std::vector<QVector3D> clipped;
+        for (uint i = 0; i < pts.size(); i++)
+        {
+            QVector3D p = pts[i], q = pts[(i + 1) % pts.size()];
+            float dp = QVector3D::dotProduct(pl.toVector3D(), p) + pl.w();
+            float dq = QVector3D::dotProduct(pl.toVector3D(), q) + pl.w();
+
+            if (dp >= 0.0)
+                clipped.push_back(p);
+            if ((dp >= 0.0) != (dq >= 0.0))
+                clipped.push_back(p + (q - p) * (dp / (dp - dq)));
+        }
+
+        pts.swap(clipped);
+        if (pts.empty())
+            return false;
+    }
+
+    return true;
+}
+
+
+Lasso::Lasso(const std::vector<QPointF> &points)
+{
+    uint n = points.size();
+    QPointF lo = n > 0 ? points[0] : QPointF(), hi = lo;
+
+    for (uint i = 0; i < n; i++)
+    {
+        QPointF a = points[i], b = points[(i + 1) % n];
+        x0.push_back(a.x());
+        y0.push_back(a.y());
+        y1.push_back(b.y());
+        dxdy.push_back(a.y() != b.y() ? (b.x() - a.x()) / (b.y() - a.y()) : 0.0);
+
+        lo = QPointF(std::min(lo.x(), a.x()), std::min(lo.y(), a.y()));
+        hi = QPointF(std::max(hi.x(), a.x()), std::max(hi.y(), a.y()));
+    }
+
+    _bounds = QRectF(lo, hi);
+}
+
+
+bool Lasso::contains(float x, float y) const
+{
+    // Crossing number test, written without branches so the loop vectorizes
+    uint crossings = 0;
+    for (uint i = 0; i < x0.size(); i++)
+        crossings += ((y0[i] > y) != (y1[i] > y)) & (x < x0[i] + (y - y0[i]) * dxdy[i]);
+
+    return crossings & 1;
+}
+
+
+Picker::Picker(const QMatrix4x4 &mvp, int width, int height, bool exteriorOnly)
+    : mvp(mvp)
+    , inv(mvp.inverted())
+    , width(width)
+    , height(height)
+    , exteriorOnly(exteriorOnly)
+    , lasso(NULL)
+{
+}
+
+
+std::set<std::pair<uint,uint>> Picker::pick(int x, int y, int w, int h, SelectionMode mode, bool xray)
+{
+    refreshTop();
+
+    std::set<std::pair<uint,uint>> picks;
+    if (!xray && w <= CLICK_SIZE && h <= CLICK_SIZE)
+        pickRay(x + w/2, y + h/2, mode, &picks);
+    else
+        pickFrustum(x, y, w, h, mode, xray, &picks);
+
+    return picks;
+}
+
+
+std::set<std::pair<uint,uint>> Picker::pick(const Lasso &lasso, SelectionMode mode, bool xray)
+{
+    refreshTop();
+
+    // The frustum through the bounding rectangle does the culling, and samples inside it are
+    // tested against the polygon
+    QRectF b = lasso.bounds();
+    int x = std::max((int) std::floor(b.left()), 0);
+    int y = std::max((int) std::floor(b.top()), 0);
+    int w = std::min((int) std::ceil(b.right()), width) - x;
+    int h = std::min((int) std::ceil(b.bottom()), height) - y;
+
+    std::set<std::pair<uint,uint>> picks;
+    if (w <= 0 || h <= 0)
+        return picks;
+
+    this->lasso = &lasso;
+    pickFrustum(x, y, w, h, mode, xray, &picks);
+    this->lasso = NULL;
+
+    return picks;
+}
+
+
+QVector3D Picker::unproject(float x, float y, float z)
+{
+    return (inv * QVector4D(2.0 * x / width - 1.0, 2.0 * y / height - 1.0, z, 1.0)).toVector3DAffine();
+}
+
+
+Picker::ray Picker::through(float x, float y)
+{
+    ray r;
+
+    r.orig = unproject(x, y, -1.0);
+    QVector3D to = unproject(x, y, 1.0);
+    r.dir = to - r.orig;
+    r.length = r.dir.length();
+    r.dir /= r.length;
+
+    r.tolNear = PICK_RADIUS * (unproject(x + 1.0, y, -1.0) - r.orig).length();
+    r.tolFar = PICK_RADIUS * (unproject(x + 1.0, y, 1.0) - to).length();
+
+    return r;
+}
+
+
+float Picker::firstFace(const ray &r, float tmax, DisplayObject **hitObj, uint *hitFace)
+{
+    top.ray(r.orig, r.dir, tmax, 0.0, [&] (uint i) {
+        DisplayObject *obj = topObjects[i];
+        const std::vector<QVector3D> &verts = obj->vertices();
+        const std::vector<quad> &faces = obj->faces();
+
+        obj->faceBVH().ray(r.orig, r.dir, tmax, 0.0, [&] (uint q) {
+            uint f = obj->faceOf(q);
+            if (!faceShown(obj, f))
+                return tmax;
+
+            const quad &fq = faces[q];
+            float t;
+            if ((hitTriangle(r.orig, r.dir, verts[fq.a], verts[fq.b], verts[fq.c], &t) ||
+                 hitTriangle(r.orig, r.dir, verts[fq.a], verts[fq.c], verts[fq.d], &t)) && t < tmax)
+            {
+                tmax = t;
+                *hitObj = obj;
+                *hitFace = f;
+            }
+            return tmax;
+        });
+
+        return tmax;
+    });
+
+    return tmax;
+}
+
+
+bool Picker::nearestEdge(const ray &r, float tmax, DisplayObject **hitObj, uint *hitEdge)
+{
+    bool found = false;
+    float best = 1.0, bestT = tmax;
+    float pad = tolerance(r, tmax);
+
+    top.ray(r.orig, r.dir, tmax, pad, [&] (uint i) {
+        DisplayObject *obj = topObjects[i];
+        const std::vector<QVector3D> &verts = obj->vertices();
+        const std::vector<pair> &edges = obj->edges();
+
+        obj->edgeBVH().ray(r.orig, r.dir, tmax, pad, [&] (uint s) {
+            uint e = obj->edgeOf(s);
+            if (!obj->edgeVisible(e))
+                return tmax;
+
+            float t, dist;
+            closestOnSegment(r.orig, r.dir, verts[edges[s].a], verts[edges[s].b], &t, &dist);
+
+            // Prefer the edge closest to the ray in pixels, then the one closest to the viewer
+            float score = dist / tolerance(r, t);
+            if (t <= tmax && score <= 1.0 && (!found || score < best || (score == best && t < bestT)))
+            {
+                found = true;
+                best = score;
+                bestT = t;
+                *hitObj = obj;
+                *hitEdge = e;
+            }
+            return tmax;
+        });
+
+        return tmax;
+    });
+
+    return found;
+}
+
+
+bool Picker::nearestPoint(const ray &r, float tmax, DisplayObject **hitObj, uint *hitPoint)
+{
+    bool found = false;
+    float best = 1.0, bestT = tmax;
+
+    top.ray(r.orig, r.dir, tmax, tolerance(r, tmax), [&] (uint i) {
+        DisplayObject *obj = topObjects[i];
+        const std::vector<QVector3D> &verts = obj->vertices();
+        const std::vector<GLuint> &points = obj->points();
+
+        for (uint p = 0; p < points.size(); p++)
+        {
+            if (!obj->pointVisible(p))
+                continue;
+
+            QVector3D v = verts[points[p]];
+            float t = QVector3D::dotProduct(v - r.orig, r.dir);
+            if (t < 0.0 || t > tmax)
+                continue;
+
+            float score = (r.orig + t * r.dir - v).length() / tolerance(r, t);
+            if (score <= 1.0 && (!found || score < best || (score == best && t < bestT)))
+            {
+                found = true;
+                best = score;
+                bestT = t;
+                *hitObj = obj;
+                *hitPoint = p;
+            }
+        }
+
+        return tmax;
+    });
+
+    return found;
+}
+
+
+bool Picker::visible(QVector3D p)
+{
+    QVector4D c = mvp * QVector4D(p, 1.0);
+    ray r = through((c.x() / c.w() + 1.0) * width / 2, (c.y() / c.w() + 1.0) * height / 2);
+
+    float tmax = QVector3D::dotProduct(p - r.orig, r.dir) * (1.0 - DEPTH_SLACK);
+    DisplayObject *obj;
+    uint face;
+    return firstFace(r, tmax, &obj, &face) == tmax;
+}
+
+
+bool Picker::contains(const std::vector<QVector4D> &planes, QVector3D p)
+{
+    if (!inside(planes, p))
+        return false;
+    if (!lasso)
+        return true;
+
+    QVector4D c = mvp * QVector4D(p, 1.0);
+    return lasso->contains((c.x() / c.w() + 1.0) * width / 2, (c.y() / c.w() + 1.0) * height / 2);
+}
+
+
+void Picker::pickRay(int x, int y, SelectionMode mode, std::set<std::pair<uint,uint>> *picks)
+{
+    ray r = through(x + 0.5, y + 0.5);
+
+    DisplayObject *obj = NULL;
+    uint idx = 0;
+    float t = firstFace(r, r.length, &obj, &idx);
+
+    if ((mode == SM_PATCH || mode == SM_FACE) && obj)
+    {
+        picks->insert(std::pair<uint,uint>(obj->index(), mode == SM_FACE ? idx : 0));
+        return;
+    }
+
+    // Edges and points are only hidden by faces that are clearly in front of them
+    float tmax = std::min(t * (float) (1.0 + DEPTH_SLACK), r.length);
+
+    if ((mode == SM_PATCH || mode == SM_EDGE) && nearestEdge(r, tmax, &obj, &idx))
+        picks->insert(std::pair<uint,uint>(obj->index(), mode == SM_EDGE ? idx : 0));
+    else if (mode == SM_POINT && nearestPoint(r, tmax, &obj, &idx))
+        picks->insert(std::pair<uint,uint>(obj->index(), idx));
+}
+
+
+void Picker::pickFrustum(int x, int y, int w, int h, SelectionMode mode, bool xray,
+                         std::set<std::pair<uint,uint>> *picks)
+{
+    float x0 = 2.0 * x / width - 1.0, x1 = 2.0 * (x + w) / width - 1.0;
+    float y0 = 2.0 * y / height - 1.0, y1 = 2.0 * (y + h) / height - 1.0;
+
+    QVector4D r0 = mvp.row(0), r1 = mvp.row(1), r2 = mvp.row(2), r3 = mvp.row(3);
+    std::vector<QVector4D> planes = {r0 - x0 * r3, x1 * r3 - r0, r1 - y0 * r3, y1 * r3 - r1, r3 + r2, r3 - r2};
+
+    // Faces crossing the rectangle without any corner or center inside it are picked if they are
+    // the first hit through its center, or in x-ray mode if they overlap it. Edges crossing it are
+    // picked in x-ray mode. This does not apply to lassos.
+    DisplayObject *centerObj = NULL;
+    uint centerFace = 0;
+    if (!xray && !lasso)
+    {
+        ray center = through(x + w / 2.0, y + h / 2.0);
+        firstFace(center, center.length, &centerObj, &centerFace);
+    }
+
+    top.frustum(planes, [&] (uint i) {
+        DisplayObject *obj = topObjects[i];
+        if (obj->isInvisible(true))
+            return;
+
+        const std::vector<QVector3D> &verts = obj->vertices();
+
+        if (mode == SM_PATCH || mode == SM_FACE)
+        {
+            const std::vector<quad> &faces = obj->faces();
+            obj->faceBVH().frustum(planes, [&] (uint q) {
+                uint f = obj->faceOf(q);
+                std::pair<uint,uint> key(obj->index(), mode == SM_FACE ? f : 0);
+                if (!faceShown(obj, f) || picks->find(key) != picks->end())
+                    return;
+
+                const quad &fq = faces[q];
+                QVector3D a = verts[fq.a], b = verts[fq.b], c = verts[fq.c], d = verts[fq.d];
+                if (outside(planes, {a, b, c, d}))
+                    return;
+
+                bool sampled = false;
+                for (auto &p : {(a + b + c + d) / 4, a, b, c, d})
+                    if (contains(planes, p))
+                    {
+                        sampled = true;
+                        if (xray || visible(p))
+                        {
+                            picks->insert(key);
+                            return;
+                        }
+                    }
+
+                if (sampled || lasso)
+                    return;
+
+                if (xray ? overlaps(planes, {a, b, c}) || overlaps(planes, {a, c, d})
+                         : obj == centerObj && f == centerFace)
+                    picks->insert(key);
+            });
+        }
+
+        if (mode == SM_PATCH || mode == SM_EDGE)
+        {
+            const std::vector<pair> &edges = obj->edges();
+            obj->edgeBVH().frustum(planes, [&] (uint s) {
+                uint e = obj->edgeOf(s);
+                std::pair<uint,uint> key(obj->index(), mode == SM_EDGE ? e : 0);
+                if (!obj->edgeVisible(e) || picks->find(key) != picks->end())
+                    return;
+
+                QVector3D a = verts[edges[s].a], b = verts[edges[s].b];
+                bool sampled = false;
+                for (auto &p : {(a + b) / 2, a, b})
+                    if (contains(planes, p))
+                    {
+                        sampled = true;
+                        if (xray || visible(p))
+                        {
+                            picks->insert(key);
+                            return;
+                        }
+                    }
+
+                if (!sampled && !lasso && xray && overlaps(planes, {a, b}))
+                    picks->insert(key);
+            });
+        }
+
+        if (mode == SM_POINT)
+        {
+            const std::vector<GLuint> &points = obj->points();
+            for (uint p = 0; p < points.size(); p++)
+                if (obj->pointVisible(p) && contains(planes, verts[points[p]]) &&
+                    (xray || visible(verts[points[p]])))
+                    picks->insert(std::pair<uint,uint>(obj->index(), p));
+        }
+    });
+}
+
+
+void Picker::refreshTop()
+{
+    if (top.built() && topGeneration == DisplayObject::generation())
+        return;
+
+    topObjects.clear();
+    std::vector<box> boxes;
+
+    for (auto it = DisplayObject::begin(); it != DisplayObject::end(); it++)
+    {
+        DisplayObject *obj = it->second;
+        QVector3D r(obj->radius(), obj->radius(), obj->radius());
+        topObjects.push_back(obj);
+        boxes.push_back({obj->center() - r, obj->center() + r});
+    }
+
+    top.build(boxes);
+    topGeneration = DisplayObject::generation();
+}
@@ -0,0 +1,81 @@
+#include <set>
+#include <vector>
+#include <QMatrix4x4>
+#include <QPointF>
+#include <QRectF>
+#include <QVector3D>
+#include <QVector4D>
+
+#include "BVH.h"
+#include "DisplayObject.h"
+
+#ifndef _PICKER_H_
+#define _PICKER_H_
+
+// A closed polygon in window coordinates, used for lasso and polygon selection
+class Lasso
+{
+public:
+    Lasso(const std::vector<QPointF> &points);
+    ~Lasso() { }
+
+    bool contains(float x, float y) const;
+    inline QRectF bounds() const { return _bounds; }
+
+private:
+    // One entry per polygon edge, from vertex i to vertex i+1
+    std::vector<float> x0, y0, y1, dxdy;
+    QRectF _bounds;
+};
+
+
+// Picks components by casting rays against the geometry on the CPU, without rendering anything.
+// The caller must hold DisplayObject::m.
+class Picker
+{
+public:
+    // With exteriorOnly set, interior faces are hidden like in the scene, and can not be picked
+    // or occlude anything
+    Picker(const QMatrix4x4 &mvp, int width, int height, bool exteriorOnly = false);
+    ~Picker() { }
+
+    // Window coordinates have their origin in the lower left corner, as with glReadPixels. With
+    // xray set, everything inside the rectangle is picked, whether it is occluded or not.
+    std::set<std::pair<uint,uint>> pick(int x, int y, int w, int h, SelectionMode mode, bool xray = false);
+    std::set<std::pair<uint,uint>> pick(const Lasso &lasso, SelectionMode mode, bool xray = false);
+
+private:
+    // A ray from the near to the far plane. The pick tolerance for edges and points grows linearly
+    // from tolNear to tolFar along the ray.
+    typedef struct { QVector3D orig, dir; float length, tolNear, tolFar; } ray;
+
+    QMatrix4x4 mvp, inv;
+    int width, height;
+    bool exteriorOnly;
+    const Lasso *lasso;
+
+    QVector3D unproject(float x, float y, float z);
+    ray through(float x, float y);
+    inline float tolerance(const ray &r, float t) { return r.tolNear + (r.tolFar - r.tolNear) * t / r.length; }
+    inline bool faceShown(DisplayObject *obj, uint f)
+    {
+        return obj->faceVisible(f) && !(exteriorOnly && obj->faceInterior(f));
+    }
+
+    float firstFace(const ray &r, float tmax, DisplayObject **obj, uint *face);
+    bool nearestEdge(const ray &r, float tmax, DisplayObject **obj, uint *edge);
+    bool nearestPoint(const ray &r, float tmax, DisplayObject **obj, uint *point);
+    bool visible(QVector3D p);
+    bool contains(const std::vector<QVector4D> &planes, QVector3D p);
+
+    void pickRay(int x, int y, SelectionMode mode, std::set<std::pair<uint,uint>> *picks);
+    void pickFrustum(int x, int y, int w, int h, SelectionMode mode, bool xray,
+                     std::set<std::pair<uint,uint>> *picks);
+
+    static BVH top;
+    static std::vector<DisplayObject *> topObjects;
+    static uint topGeneration;
+    static void refreshTop();
+};
+
+#endif /* _PICKER_H_ */
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "Query.h"
+
+
+Query::Query(QueryType type, QVector3D a, QVector3D b, float value, bool boundaryOnly)
+    : type(type)
+    , a(a)
+    , b(b)
+    , value(value)
+    , cosAngle(cos(value * 3.14159265 / 180.0))
+    , boundaryOnly(boundaryOnly)
+{
+    if (type == QT_BOX)
+    {
+        this->a = QVector3D(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+        this->b = QVector3D(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+    }
+    else
+        this->b.normalize();
+}
+
+
+std::set<std::pair<uint,uint>> Query::run(SelectionMode mode)
+{
+    std::vector<DisplayObject *> objects;
+    for (auto i = DisplayObject::begin(); i != DisplayObject::end(); i++)
+        if (classify(i->second->center(), i->second->radius()) >= 0)
+            objects.push_back(i->second);
+
+    uint nThreads = std::max(1u, std::min((uint) std::thread::hardware_concurrency(), (uint) objects.size()));
+    std::vector<std::vector<std::pair<uint,uint>>> picks(nThreads);
+
+    std::vector<std::thread> threads;
+    for (uint t = 0; t < nThreads; t++)
+        threads.push_back(std::thread([this, t, nThreads, mode, &objects, &picks] () {
+            for (uint i = t; i < objects.size(); i += nThreads)
+                runObject(objects[i], mode, &picks[t]);
+        }));
+
+    for (auto &t : threads)
+        t.join();
+
+    std::set<std::pair<uint,uint>> ret;
+    for (auto &p : picks)
+        ret.insert(p.begin(), p.end());
+    return ret;
+}
+
+
+int Query::classify(QVector3D center, float radius)
+{
+    switch (type)
+    {
+    case QT_BOX:
+        for (int i = 0; i < 3; i++)
+            if (center[i] + radius < a[i] || center[i] - radius > b[i])
+                return -1;
+        for (int i = 0; i < 3; i++)
+            if (center[i] - radius < a[i] || center[i] + radius > b[i])
+                return 0;
+        return 1;
+
+    case QT_PLANE:
+    {
+        float dist = fabs(QVector3D::dotProduct(b, center - a));
+        return dist > radius + value ? -1 : dist + radius <= value ? 1 : 0;
+    }
+
+    case QT_HALFSPACE:
+    {
+        float dist = QVector3D::dotProduct(b, center - a);
+        return dist < -(radius + value) ? -1 : dist - radius >= -value ? 1 : 0;
+    }
+
+    case QT_SPHERE:
+    {
+        float dist = (center - a).length();
+        return dist - radius > value ? -1 : dist + radius <= value ? 1 : 0;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+
+bool Query::matches(QVector3D p)
+{
+    switch (type)
+    {
+    case QT_BOX:
+        return (p.x() >= a.x() && p.y() >= a.y() && p.z() >= a.z() &&
+                p.x() <= b.x() && p.y() <= b.y() && p.z() <= b.z());
+    case QT_PLANE: return fabs(QVector3D::dotProduct(b, p - a)) <= value;
+    case QT_HALFSPACE: return QVector3D::dotProduct(b, p - a) >= -value;
+    case QT_SPHERE: return (p - a).length() <= value;
+    default: return false;
+    }
+}
+
+
+bool Query::matchesFace(DisplayObject *obj, uint f)
+{
+    if (boundaryOnly && obj->faceInterior(f))
+        return false;
+
+    const std::vector<QVector3D> &vertices = obj->vertices();
+    const std::vector<quad> &faces = obj->faces();
+    std::pair<uint,uint> range = obj->faceRange(f);
+
+    if (type != QT_NORMAL)
+    {
+        for (uint i = range.first; i < range.second; i++)
+            for (auto v : {faces[i].a, faces[i].b, faces[i].c, faces[i].d})
+                if (!matches(vertices[v]))
+                    return false;
+        return true;
+    }
+
+    // The normal of each element, oriented like the vertex normals used for shading
+    const std::vector<QVector3D> &normals = obj->normals();
+    for (uint i = range.first; i < range.second; i++)
+    {
+        const quad &q = faces[i];
+        QVector3D n = QVector3D::crossProduct(vertices[q.c] - vertices[q.a], vertices[q.d] - vertices[q.b]);
+        if (n.isNull())
+            continue;
+        if (QVector3D::dotProduct(n, normals[q.a] + normals[q.b] + normals[q.c] + normals[q.d]) < 0)
+            n = -n;
+        if (QVector3D::dotProduct(n.normalized(), b) < cosAngle)
+            return false;
+    }
+
+    return true;
+}
+
+
+bool Query::matchesEdge(DisplayObject *obj, uint e)
+{
+    const std::vector<QVector3D> &vertices = obj->vertices();
+    const std::vector<pair> &edges = obj->edges();
+    std::pair<uint,uint> range = obj->edgeRange(e);
+
+    for (uint i = range.first; i < range.second; i++)
+        if (!matches(vertices[edges[i].a]) || !matches(vertices[edges[i].b]))
+            return false;
+
+    return true;
+}
+
+
+void Query::runObject(DisplayObject *obj, SelectionMode mode, std::vector<std::pair<uint,uint>> *picks)
+{
+    // Patches are matched through their highest dimensional components
+    SelectionMode sub = mode;
+    if (mode == SM_PATCH)
+        sub = obj->nFaces() > 0 ? SM_FACE : obj->nEdges() > 0 ? SM_EDGE : SM_POINT;
+
+    if (type == QT_NORMAL && sub != SM_FACE)
+        return;
+
+    // Everything matches if the whole bounding sphere does, except for the face tests that do
+    // not only depend on positions
+    bool all = type != QT_NORMAL && !boundaryOnly && classify(obj->center(), obj->radius()) > 0;
+
+    uint n = sub == SM_FACE ? obj->nFaces() : sub == SM_EDGE ? obj->nEdges() : obj->nPoints();
+    for (uint c = 0; c < n; c++)
+    {
+        bool match;
+        switch (sub)
+        {
+        case SM_FACE: match = obj->faceVisible(c) && (all || matchesFace(obj, c)); break;
+        case SM_EDGE: match = obj->edgeVisible(c) && (all || matchesEdge(obj, c)); break;
+        default: match = obj->pointVisible(c) && (all || matches(obj->pointPosition(c))); break;
+        }
+
+        if (!match)
+            continue;
+
+        picks->push_back(std::make_pair(obj->index(), c));
+        if (mode == SM_PATCH)
+            return;
+    }
+}
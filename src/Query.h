@@ -0,0 +1,48 @@
+#include <set>
+#include <vector>
+#include <QVector3D>
+
+#include "DisplayObject.h"
+
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+enum QueryType { QT_BOX, QT_PLANE, QT_HALFSPACE, QT_SPHERE, QT_NORMAL };
+
+// A geometric predicate over the tessellated geometry. A face, edge or point matches if all its
+// vertices do. The meaning of the parameters depends on the type:
+// - QT_BOX: the box with corners a and b
+// - QT_PLANE: within value of the plane through a with normal b
+// - QT_HALFSPACE: on the side of that plane that b points to, or within value of it
+// - QT_SPHERE: within value of a
+// - QT_NORMAL: faces whose normal is within value degrees of the direction b
+class Query
+{
+public:
+    Query(QueryType type, QVector3D a, QVector3D b, float value, bool boundaryOnly = false);
+    ~Query() { }
+
+    // Evaluates the query over every visible component of the given mode, split over all cores.
+    // Patches match if one of their faces (or edges, or points, for lower dimensional patches)
+    // does. Interior faces are skipped with boundaryOnly set. The caller must hold
+    // DisplayObject::m.
+    std::set<std::pair<uint,uint>> run(SelectionMode mode);
+
+private:
+    QueryType type;
+    QVector3D a, b;
+    float value, cosAngle;
+    bool boundaryOnly;
+
+    // Classifies a bounding sphere: -1 if nothing inside it can match, 1 if everything does,
+    // and 0 if its contents must be tested
+    int classify(QVector3D center, float radius);
+
+    bool matches(QVector3D p);
+    bool matchesFace(DisplayObject *obj, uint f);
+    bool matchesEdge(DisplayObject *obj, uint e);
+
+    void runObject(DisplayObject *obj, SelectionMode mode, std::vector<std::pair<uint,uint>> *picks);
+};
+
+#endif /* _QUERY_H_ */
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <QStringList>
+
+#include "ObjectSet.h"
+#include "SearchIndex.h"
+
+
+void SearchIndex::add(Patch *patch)
+{
+    File *file = static_cast<File *>(patch->parent());
+
+    auto it = std::find_if(files.begin(), files.end(),
+                           [file] (const fileEntry &e) { return e.file == file; });
+    if (it == files.end())
+    {
+        files.emplace_back();
+        it = files.end() - 1;
+        it->file = file;
+        it->name = file->fn().toLower();
+    }
+
+    it->patches.push_back(patch);
+    it->byType[patch->obj()->type()].push_back(patch);
+}
+
+
+void SearchIndex::remove(File *file)
+{
+    files.erase(std::remove_if(files.begin(), files.end(),
+                               [file] (const fileEntry &e) { return e.file == file; }),
+                files.end());
+}
+
+
+std::vector<SearchIndex::match> SearchIndex::find(QString query, SelectionMode *mode)
+{
+    static const QStringList types = {"volume", "surface", "curve"};
+    static const QStringList visibilities = {"hidden", "partial", "visible"};
+    static const QStringList components = {"face", "edge", "vertex"};
+
+    int type = -1, visibility = -1, selected = -1, patchNo = -1, componentNo = -1;
+    QStringList names;
+    *mode = SM_PATCH;
+
+    QStringList terms = query.toLower().split(" ", QString::SkipEmptyParts);
+    for (int i = 0; i < terms.size(); i++)
+    {
+        const QString &term = terms[i];
+        bool isNumber, nextIsNumber = false;
+        int number = term.toInt(&isNumber);
+        int next = i + 1 < terms.size() ? terms[i+1].toInt(&nextIsNumber) : 0;
+
+        if (types.contains(term))
+            type = types.indexOf(term);
+        else if (visibilities.contains(term))
+            visibility = visibilities.indexOf(term);
+        else if (term == "selected" || term == "unselected")
+            selected = term == "selected";
+        else if (isNumber)
+            patchNo = number;
+        else if (term == "patch" && nextIsNumber)
+        {
+            patchNo = next;
+            i++;
+        }
+        else if (components.contains(term) && nextIsNumber)
+        {
+            *mode = (SelectionMode) (SM_FACE + components.indexOf(term));
+            componentNo = next;
+            i++;
+        }
+        else if (term != "patch")
+            names << term;
+    }
+
+    std::vector<match> ret;
+
+    for (auto &e : files)
+    {
+        bool nameMatches = true;
+        for (auto &name : names)
+            nameMatches &= e.name.contains(name);
+        if (!nameMatches)
+            continue;
+
+        // Look up single patches directly, and otherwise only the patches of the right type
+        std::vector<Patch *> single;
+        const std::vector<Patch *> *candidates;
+        if (patchNo >= 0)
+        {
+            if (patchNo >= 1 && patchNo <= (int) e.patches.size())
+                single.push_back(e.patches[patchNo - 1]);
+            candidates = &single;
+        }
+        else if (type >= 0)
+            candidates = &e.byType[type];
+        else
+            candidates = &e.patches;
+
+        for (auto patch : *candidates)
+        {
+            DisplayObject *obj = patch->obj();
+
+            if (type >= 0 && obj->type() != type)
+                continue;
+            if (visibility >= 0 && visibility != (patch->isInvisible() ? 0 : (patch->isFullyVisible() ? 2 : 1)))
+                continue;
+            if (selected >= 0 && selected != patch->isSelected())
+                continue;
+
+            if (componentNo < 0)
+            {
+                ret.push_back({patch, 0});
+                continue;
+            }
+
+            uint n = *mode == SM_FACE ? obj->nFaces() : (*mode == SM_EDGE ? obj->nEdges() : obj->nPoints());
+            if (componentNo >= 1 && (uint) componentNo <= n)
+                ret.push_back({patch, (uint) componentNo - 1});
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,51 @@
+#include <vector>
+#include <QString>
+
+#include "DisplayObject.h"
+
+#ifndef _SEARCHINDEX_H_
+#define _SEARCHINDEX_H_
+
+class File;
+class Patch;
+
+// An index of the patch tree for searching. A query is a list of terms, all of which must match,
+// case insensitively:
+// - 'volume', 'surface' or 'curve': the patch type
+// - 'visible', 'hidden' or 'partial': the patch visibility
+// - 'selected' or 'unselected'
+// - a number, optionally after 'patch': the patch with that label
+// - 'face', 'edge' or 'vertex' followed by a number: the component with that label, in every
+//   patch that has it
+// - anything else: part of the file name
+class SearchIndex
+{
+public:
+    SearchIndex() { }
+    ~SearchIndex() { }
+
+    typedef struct
+    {
+        Patch *patch;
+        uint component;
+    } match;
+
+    void add(Patch *patch);
+    void remove(File *file);
+
+    // Returns the matches in tree order. The mode is SM_PATCH if the query matches whole patches,
+    // or that of the component term otherwise. The caller must hold ObjectSet::m.
+    std::vector<match> find(QString query, SelectionMode *mode);
+
+private:
+    typedef struct
+    {
+        File *file;
+        QString name;
+        std::vector<Patch *> patches, byType[3];
+    } fileEntry;
+
+    std::vector<fileEntry> files;
+};
+
+#endif /* _SEARCHINDEX_H_ */
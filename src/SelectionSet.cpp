@@ -0,0 +1,228 @@
+#include <QDataStream>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+#include "SelectionSet.h"
+
+#define SET_MAGIC "BSGS"
+#define SET_VERSION 1
+
+// The smallest sizes in bytes of a binary set and entry: empty strings and no contents
+#define MIN_SET_SIZE 8
+#define MIN_ENTRY_SIZE 13
+
+
+static const char *modeNames[] = {"patch", "face", "edge", "point"};
+
+
+bool SelectionSet::save(const std::vector<SelectionSet> &sets, QString fileName, SetFormat format,
+                        QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        *error = file.errorString();
+        return false;
+    }
+
+    if (format == SF_BINARY)
+    {
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_0);
+
+        out.writeRawData(SET_MAGIC, 4);
+        out << (quint32) SET_VERSION << (quint32) sets.size();
+
+        for (auto &set : sets)
+        {
+            out << set.name << (quint32) set.entries.size();
+            for (auto &e : set.entries)
+            {
+                out << e.file << (quint32) e.patch << (quint8) e.mode << (quint32) e.indices.size();
+                for (auto i : e.indices)
+                    out << (quint32) i;
+            }
+        }
+
+        if (out.status() != QDataStream::Ok)
+        {
+            *error = "Write error";
+            return false;
+        }
+    }
+    else
+    {
+        QTextStream out(&file);
+
+        out << "# BSGUI selection sets\n";
+        out << "# Each entry is a line '<type> <patch> <file>', followed by a line of indices\n";
+
+        for (auto &set : sets)
+        {
+            out << "set " << set.name << "\n";
+            for (auto &e : set.entries)
+            {
+                out << modeNames[e.mode] << " " << e.patch << " " << e.file << "\n";
+                for (uint i = 0; i < e.indices.size(); i++)
+                    out << (i > 0 ? " " : "") << e.indices[i];
+                out << "\n";
+            }
+        }
+    }
+
+    return true;
+}
+
+
+static bool loadBinary(std::vector<SelectionSet> *sets, QFile &file, QString *error)
+{
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    in.skipRawData(4);
+
+    quint32 version, nSets;
+    in >> version >> nSets;
+    if (version > SET_VERSION)
+    {
+        *error = QString("Unsupported version %1").arg(version);
+        return false;
+    }
+
+    // Counts are checked against the remaining size before anything is allocated for them
+    if (nSets > file.bytesAvailable() / MIN_SET_SIZE)
+    {
+        *error = "Truncated file";
+        return false;
+    }
+
+    for (quint32 s = 0; s < nSets && in.status() == QDataStream::Ok; s++)
+    {
+        SelectionSet set;
+        quint32 nEntries;
+        in >> set.name >> nEntries;
+
+        if (nEntries > file.bytesAvailable() / MIN_ENTRY_SIZE)
+        {
+            *error = "Truncated file";
+            return false;
+        }
+
+        for (quint32 i = 0; i < nEntries && in.status() == QDataStream::Ok; i++)
+        {
+            SelectionSet::entry e;
+            quint32 patch, nIndices;
+            quint8 mode;
+            in >> e.file >> patch >> mode >> nIndices;
+
+            if (mode > SM_POINT)
+            {
+                *error = QString("Unknown component type %1").arg(mode);
+                return false;
+            }
+
+            e.patch = patch;
+            e.mode = (SelectionMode) mode;
+
+            if (nIndices > file.bytesAvailable() / 4)
+            {
+                *error = "Truncated file";
+                return false;
+            }
+
+            e.indices.resize(nIndices);
+            for (quint32 j = 0; j < nIndices; j++)
+            {
+                quint32 idx;
+                in >> idx;
+                e.indices[j] = idx;
+            }
+
+            set.entries.push_back(e);
+        }
+
+        sets->push_back(set);
+    }
+
+    if (in.status() != QDataStream::Ok)
+    {
+        *error = "Truncated file";
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool loadText(std::vector<SelectionSet> *sets, QFile &file, QString *error)
+{
+    QTextStream in(&file);
+
+    uint lineNo = 0;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine();
+        lineNo++;
+
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+
+        if (line.startsWith("set "))
+        {
+            sets->push_back(SelectionSet(line.mid(4)));
+            continue;
+        }
+
+        QStringList head = line.split(" ");
+        int mode = -1;
+        for (int m = SM_PATCH; m <= SM_POINT; m++)
+            if (head[0] == modeNames[m])
+                mode = m;
+
+        bool ok = false;
+        uint patch = head.size() >= 3 ? head[1].toUInt(&ok) : 0;
+        if (mode < 0 || !ok || sets->empty())
+        {
+            *error = QString("Syntax error on line %1").arg(lineNo);
+            return false;
+        }
+
+        SelectionSet::entry e;
+        e.file = QStringList(head.mid(2)).join(" ");
+        e.patch = patch;
+        e.mode = (SelectionMode) mode;
+
+        // The index line is always present, even if it is empty
+        QStringList indices = in.readLine().split(" ", QString::SkipEmptyParts);
+        lineNo++;
+        e.indices.reserve(indices.size());
+        for (auto &idx : indices)
+        {
+            e.indices.push_back(idx.toUInt(&ok));
+            if (!ok)
+            {
+                *error = QString("Invalid index '%1' on line %2").arg(idx).arg(lineNo);
+                return false;
+            }
+        }
+
+        sets->back().entries.push_back(e);
+    }
+
+    return true;
+}
+
+
+bool SelectionSet::load(std::vector<SelectionSet> *sets, QString fileName, QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        *error = file.errorString();
+        return false;
+    }
+
+    if (file.peek(4) == SET_MAGIC)
+        return loadBinary(sets, file, error);
+    return loadText(sets, file, error);
+}
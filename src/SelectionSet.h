@@ -0,0 +1,44 @@
+#include <vector>
+#include <QString>
+
+#include "DisplayObject.h"
+
+#ifndef _SELECTIONSET_H_
+#define _SELECTIONSET_H_
+
+enum SetFormat { SF_BINARY, SF_TEXT };
+
+// A named selection, stored by file name and patch index so that it survives reloads. Each entry
+// selects either a whole patch (SM_PATCH, no indices) or some of its faces, edges or points.
+class SelectionSet
+{
+public:
+    typedef struct
+    {
+        QString file;
+        uint patch;
+        SelectionMode mode;
+        std::vector<uint> indices;
+    } entry;
+
+    SelectionSet(QString name = "") : name(name) { }
+    ~SelectionSet() { }
+
+    QString name;
+    std::vector<entry> entries;
+
+    inline uint nComponents()
+    {
+        uint n = 0;
+        for (auto &e : entries)
+            n += e.mode == SM_PATCH ? 1 : e.indices.size();
+        return n;
+    }
+
+    // Binary files start with a magic number, and are otherwise read as text. Returns false and
+    // sets error on failure.
+    static bool save(const std::vector<SelectionSet> &sets, QString fileName, SetFormat format, QString *error);
+    static bool load(std::vector<SelectionSet> *sets, QString fileName, QString *error);
+};
+
+#endif /* _SELECTIONSET_H_ */
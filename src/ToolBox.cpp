@@ -1,5 +1,7 @@
 #include <cmath>
 #include <QAbstractItemModel>
+#include <QComboBox>
+#include <QFileDialog>
 #include <QGridLayout>
 #include <QGroupBox>
 #include <QHBoxLayout>
@@ -25,6 +27,21 @@ TreePanel::TreePanel(GLWidget *glWidget, ObjectSet *objectSet, QWidget *filter,
 {
     QVBoxLayout *layout = new QVBoxLayout();
 
+    QLineEdit *search = new QLineEdit();
+    search->setPlaceholderText("Search, e.g. 'volume hidden', 'patch 12' or 'face 3'");
+    search->setClearButtonEnabled(true);
+    layout->addWidget(search);
+
+    QHBoxLayout *searchLayout = new QHBoxLayout();
+    layout->addLayout(searchLayout);
+
+    QLabel *nMatches = new QLabel();
+    searchLayout->addWidget(nMatches, 1);
+    QPushButton *selectMatchesBtn = new QPushButton("Select matches");
+    searchLayout->addWidget(selectMatchesBtn);
+    QPushButton *showMatchesBtn = new QPushButton("Show only matches");
+    searchLayout->addWidget(showMatchesBtn);
+
     QTreeView *treeView = new QTreeView();
     treeView->installEventFilter(filter);
     layout->addWidget(treeView);
@@ -35,6 +52,23 @@ TreePanel::TreePanel(GLWidget *glWidget, ObjectSet *objectSet, QWidget *filter,
     treeView->resizeColumnToContents(1);
     treeView->resizeColumnToContents(2);
 
+    QObject::connect(search, &QLineEdit::textChanged,
+                     [objectSet, treeView, nMatches, selectMatchesBtn, showMatchesBtn] (const QString &text) {
+                         bool empty = text.trimmed().isEmpty();
+                         uint n = objectSet->search(empty ? "" : text);
+                         nMatches->setText(empty ? "" : QString("%1 matches").arg(n));
+                         selectMatchesBtn->setEnabled(!empty);
+                         showMatchesBtn->setEnabled(!empty);
+                         if (!empty && n > 0)
+                             treeView->scrollTo(objectSet->matchIndex(0));
+                     });
+    selectMatchesBtn->setEnabled(false);
+    showMatchesBtn->setEnabled(false);
+    QObject::connect(selectMatchesBtn, &QPushButton::clicked,
+                     [objectSet] (bool checked) { objectSet->selectMatches(); });
+    QObject::connect(showMatchesBtn, &QPushButton::clicked,
+                     [objectSet] (bool checked) { objectSet->showOnlyMatches(); });
+
 
     QGroupBox *selModePanel = new QGroupBox("Selection mode");
     layout->addWidget(selModePanel);
@@ -73,6 +107,22 @@ TreePanel::TreePanel(GLWidget *glWidget, ObjectSet *objectSet, QWidget *filter,
                          pointsBtn->setChecked(mode == SM_POINT);
                      });
 
+    QCheckBox *cpuPicking = new QCheckBox("Pick on CPU");
+    selModeLayout->addWidget(cpuPicking, 2, 0, 1, 2);
+    cpuPicking->setChecked(glWidget->cpuPicking());
+
+    QObject::connect(cpuPicking, &QCheckBox::toggled,
+                     [glWidget] (bool checked) { glWidget->setCpuPicking(checked); });
+
+    QComboBox *tool = new QComboBox();
+    tool->addItems({"Rectangle", "Lasso", "Polygon"});
+    tool->setCurrentIndex(glWidget->selectionTool());
+    selModeLayout->addWidget(new QLabel("Tool"), 3, 0, 1, 1);
+    selModeLayout->addWidget(tool, 3, 1, 1, 1);
+
+    QObject::connect(tool, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                     [glWidget] (int index) { glWidget->setSelectionTool((selectTool) index); });
+
     setLayout(layout);
 }
 
@@ -126,6 +176,221 @@ void newPresetsRadioButton(QString title, QGridLayout *layout, int row, int col,
 }
 
 
+QueryPanel::QueryPanel(ObjectSet *objectSet, QWidget *parent, Qt::WindowFlags flags)
+    : QWidget(parent, flags)
+    , objectSet(objectSet)
+{
+    QGridLayout *layout = new QGridLayout();
+
+    int row = 0;
+
+
+    type = new QComboBox();
+    type->addItems({"Inside box", "On plane", "Plane side", "Inside sphere", "Normal direction"});
+    layout->addWidget(new QLabel("Predicate"), row, 0, 1, 1);
+    layout->addWidget(type, row, 1, 1, 3);
+
+    QObject::connect(type, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                     this, &QueryPanel::typeChanged);
+
+    row++;
+
+
+    aLabel = new QLabel();
+    bLabel = new QLabel();
+    layout->addWidget(aLabel, row, 0, 1, 1);
+    layout->addWidget(bLabel, row+1, 0, 1, 1);
+
+    for (int i = 0; i < 3; i++)
+    {
+        for (auto spin : {&a[i], &b[i]})
+        {
+            *spin = new QDoubleSpinBox();
+            (*spin)->setMinimum(-std::numeric_limits<double>::infinity());
+            (*spin)->setMaximum(std::numeric_limits<double>::infinity());
+            (*spin)->setDecimals(4);
+        }
+        layout->addWidget(a[i], row, i+1, 1, 1);
+        layout->addWidget(b[i], row+1, i+1, 1, 1);
+    }
+
+    row += 2;
+
+
+    valueLabel = new QLabel();
+    value = new QDoubleSpinBox();
+    value->setMaximum(std::numeric_limits<double>::infinity());
+    value->setDecimals(4);
+    layout->addWidget(valueLabel, row, 0, 1, 1);
+    layout->addWidget(value, row, 1, 1, 3);
+
+    row++;
+
+
+    boundaryOnly = new QCheckBox("Boundary faces only");
+    boundaryOnly->setChecked(true);
+    layout->addWidget(boundaryOnly, row, 0, 1, 4);
+
+    row++;
+
+
+    QPushButton *selectBtn = new QPushButton("Select");
+    layout->addWidget(selectBtn, row, 0, 1, 2);
+    QPushButton *addBtn = new QPushButton("Add to selection");
+    layout->addWidget(addBtn, row, 2, 1, 2);
+
+    QObject::connect(selectBtn, &QPushButton::clicked, [this] (bool checked) { run(true); });
+    QObject::connect(addBtn, &QPushButton::clicked, [this] (bool checked) { run(false); });
+
+    row++;
+
+
+    typeChanged(type->currentIndex());
+
+    QWidget *fill = new QWidget();
+    layout->addWidget(fill, row, 0, 1, -1);
+
+    layout->setRowStretch(row, 1);
+    layout->setColumnStretch(1, 1);
+    layout->setColumnStretch(2, 1);
+    layout->setColumnStretch(3, 1);
+    setLayout(layout);
+}
+
+
+void QueryPanel::typeChanged(int index)
+{
+    static const char *aNames[] = {"Min corner", "Point", "Point", "Center", ""};
+    static const char *bNames[] = {"Max corner", "Normal", "Normal", "", "Direction"};
+    static const char *valueNames[] = {"", "Tolerance", "Tolerance", "Radius", "Angle (degrees)"};
+
+    aLabel->setText(aNames[index]);
+    bLabel->setText(bNames[index]);
+    valueLabel->setText(valueNames[index]);
+
+    for (int i = 0; i < 3; i++)
+    {
+        a[i]->setEnabled(*aNames[index]);
+        b[i]->setEnabled(*bNames[index]);
+    }
+    value->setEnabled(*valueNames[index]);
+}
+
+
+void QueryPanel::run(bool clear)
+{
+    Query query((QueryType) type->currentIndex(),
+                QVector3D(a[0]->value(), a[1]->value(), a[2]->value()),
+                QVector3D(b[0]->value(), b[1]->value(), b[2]->value()),
+                value->value(), boundaryOnly->isChecked());
+    objectSet->selectByQuery(query, clear);
+}
+
+
+SetsPanel::SetsPanel(ObjectSet *objectSet, QWidget *parent, Qt::WindowFlags flags)
+    : QWidget(parent, flags)
+    , objectSet(objectSet)
+{
+    QGridLayout *layout = new QGridLayout();
+
+    int row = 0;
+
+
+    list = new QListWidget();
+    layout->addWidget(list, row, 0, 1, 3);
+
+    QObject::connect(objectSet, &ObjectSet::selectionSetsChanged, this, &SetsPanel::setsChanged);
+    QObject::connect(list, &QListWidget::currentTextChanged,
+                     [this] (const QString &text) { name->setText(text); });
+    QObject::connect(list, &QListWidget::itemDoubleClicked,
+                     [objectSet] (QListWidgetItem *item) { objectSet->applySelectionSet(item->text()); });
+
+    row++;
+
+
+    name = new QLineEdit();
+    name->setPlaceholderText("Set name");
+    layout->addWidget(name, row, 0, 1, 3);
+
+    row++;
+
+
+    QPushButton *storeBtn = new QPushButton("Store");
+    layout->addWidget(storeBtn, row, 0, 1, 1);
+    QPushButton *applyBtn = new QPushButton("Apply");
+    layout->addWidget(applyBtn, row, 1, 1, 1);
+    QPushButton *removeBtn = new QPushButton("Remove");
+    layout->addWidget(removeBtn, row, 2, 1, 1);
+
+    QObject::connect(storeBtn, &QPushButton::clicked,
+                     [this, objectSet] (bool checked) {
+                         if (!name->text().isEmpty())
+                             objectSet->storeSelectionSet(name->text());
+                     });
+    QObject::connect(applyBtn, &QPushButton::clicked,
+                     [this, objectSet] (bool checked) { objectSet->applySelectionSet(name->text()); });
+    QObject::connect(removeBtn, &QPushButton::clicked,
+                     [this, objectSet] (bool checked) { objectSet->removeSelectionSet(name->text()); });
+
+    row++;
+
+
+    QPushButton *saveBtn = new QPushButton("Save...");
+    layout->addWidget(saveBtn, row, 0, 1, 1);
+    QPushButton *loadBtn = new QPushButton("Load...");
+    layout->addWidget(loadBtn, row, 1, 1, 1);
+
+    QObject::connect(saveBtn, &QPushButton::clicked, [this] (bool checked) { save(); });
+    QObject::connect(loadBtn, &QPushButton::clicked, [this] (bool checked) { load(); });
+
+    row++;
+
+
+    QWidget *fill = new QWidget();
+    layout->addWidget(fill, row, 0, 1, -1);
+
+    layout->setRowStretch(row, 1);
+    setLayout(layout);
+}
+
+
+void SetsPanel::setsChanged()
+{
+    QString current = name->text();
+
+    list->clear();
+    for (auto &n : objectSet->selectionSetNames())
+        list->addItem(n);
+
+    name->setText(current);
+}
+
+
+void SetsPanel::save()
+{
+    QString filter;
+    QString fn = QFileDialog::getSaveFileName(
+        this, "Save selection sets", ".",
+        "Binary selection sets (*.bss);;Text selection sets (*.txt)", &filter);
+    if (fn.isEmpty())
+        return;
+
+    objectSet->saveSelectionSets(fn, filter.startsWith("Text") ? SF_TEXT : SF_BINARY);
+}
+
+
+void SetsPanel::load()
+{
+    QString fn = QFileDialog::getOpenFileName(
+        this, "Load selection sets", ".",
+        "Selection sets (*.bss *.txt);;All files (*)");
+    if (fn.isEmpty())
+        return;
+
+    objectSet->loadSelectionSets(fn);
+}
+
+
 CameraPanel::CameraPanel(GLWidget *glWidget, ObjectSet *objectSet,
                          QWidget *parent, Qt::WindowFlags flags)
     : QWidget(parent, flags)
@@ -327,6 +592,36 @@ CameraPanel::CameraPanel(GLWidget *glWidget, ObjectSet *objectSet,
     row++;
 
 
+    singlePassLines = new QCheckBox("Single pass element lines");
+    layout->addWidget(singlePassLines, row, 0, 1, 3);
+    singlePassLines->setChecked(glWidget->singlePassLines());
+
+    QObject::connect(singlePassLines, &QCheckBox::toggled,
+                     [glWidget] (bool checked) { glWidget->setSinglePassLines(checked); });
+
+    row++;
+
+
+    exteriorOnly = new QCheckBox("Hide interior faces");
+    layout->addWidget(exteriorOnly, row, 0, 1, 3);
+    exteriorOnly->setChecked(glWidget->exteriorOnly());
+
+    QObject::connect(exteriorOnly, &QCheckBox::toggled,
+                     [glWidget] (bool checked) { glWidget->setExteriorOnly(checked); });
+
+    row++;
+
+
+    occlusionCulling = new QCheckBox("Occlusion culling");
+    layout->addWidget(occlusionCulling, row, 0, 1, 3);
+    occlusionCulling->setChecked(glWidget->occlusionCulling());
+
+    QObject::connect(occlusionCulling, &QCheckBox::toggled,
+                     [glWidget] (bool checked) { glWidget->setOcclusionCulling(checked); });
+
+    row++;
+
+
     QObject::connect(glWidget, &GLWidget::fixedChanged, this, &CameraPanel::fixedChanged);
 
 
@@ -430,6 +725,12 @@ ToolBox::ToolBox(GLWidget *glWidget, ObjectSet *objectSet,
     CameraPanel *cameraPanel = new CameraPanel(glWidget, objectSet, NULL);
     toolBox->addItem(cameraPanel, "Camera");
 
+    QueryPanel *queryPanel = new QueryPanel(objectSet, NULL);
+    toolBox->addItem(queryPanel, "Query");
+
+    SetsPanel *setsPanel = new SetsPanel(objectSet, NULL);
+    toolBox->addItem(setsPanel, "Selection sets");
+
     toolBox->setCurrentIndex(0);
 
     setWidget(toolBox);
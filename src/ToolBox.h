@@ -1,7 +1,10 @@
 #include <QCheckBox>
+#include <QComboBox>
 #include <QDockWidget>
 #include <QDoubleSpinBox>
 #include <QLabel>
+#include <QLineEdit>
+#include <QListWidget>
 #include <QPushButton>
 #include <QRadioButton>
 #include <QSize>
@@ -46,7 +49,7 @@ private:
     QDoubleSpinBox *lookAtX, *lookAtY, *lookAtZ;
 
     QRadioButton *perspectiveBtn, *orthographicBtn;
-    QCheckBox *showAxes, *showPoints;
+    QCheckBox *showAxes, *showPoints, *singlePassLines, *exteriorOnly, *occlusionCulling;
 };
 
 
@@ -63,6 +66,53 @@ public:
 };
 
 
+class QueryPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    QueryPanel(ObjectSet *objectSet, QWidget *parent = NULL, Qt::WindowFlags flags = 0);
+    ~QueryPanel() { }
+
+    QSize sizeHint() const { return QSize(300, 100); }
+
+public slots:
+    void typeChanged(int index);
+    void run(bool clear);
+
+private:
+    ObjectSet *objectSet;
+
+    QComboBox *type;
+    QLabel *aLabel, *bLabel, *valueLabel;
+    QDoubleSpinBox *a[3], *b[3], *value;
+    QCheckBox *boundaryOnly;
+};
+
+
+class SetsPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    SetsPanel(ObjectSet *objectSet, QWidget *parent = NULL, Qt::WindowFlags flags = 0);
+    ~SetsPanel() { }
+
+    QSize sizeHint() const { return QSize(300, 100); }
+
+public slots:
+    void setsChanged();
+    void save();
+    void load();
+
+private:
+    ObjectSet *objectSet;
+
+    QListWidget *list;
+    QLineEdit *name;
+};
+
+
 class ToolBox : public QDockWidget
 {
     Q_OBJECT
@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Topology.h"
+
+// Components closer than this, relative to the largest coordinates of all objects added, are
+// coincident. Floats resolve positions to about 1e-7 of their magnitude, so the tolerance must
+// follow the whole scene rather than any single object.
+#define TOPOLOGY_TOLERANCE 1e-6
+
+
+uint Topology::add(DisplayObject *obj)
+{
+    // Rejoining everything is needed when the scene grows, so the tolerance at least doubles then
+    uint nInterior = 0;
+    float needed = TOPOLOGY_TOLERANCE * std::max(1.0f, obj->center().length() + obj->radius());
+    if (needed > tol)
+        nInterior += rebuild(std::max(needed, 2 * tol));
+
+    uint index = obj->index();
+
+    std::vector<uint> &points = objEntities[0][index];
+    points.clear();
+    for (uint p = 0; p < obj->nPoints(); p++)
+        points.push_back(join(0, obj->pointPosition(p), {}, index, p));
+
+    std::vector<uint> &edges = objEntities[1][index];
+    edges.clear();
+    for (uint e = 0; e < obj->nEdges(); e++)
+    {
+        const pair &s = obj->pointsOfEdge(e);
+        std::vector<uint> key = {points[s.a], points[s.b]};
+        std::sort(key.begin(), key.end());
+        edges.push_back(join(1, obj->edgeCentroid(e), key, index, e));
+    }
+
+    std::vector<uint> &faces = objEntities[2][index];
+    faces.clear();
+    for (uint f = 0; f < obj->nFaces(); f++)
+    {
+        const quad &q = obj->edgesOfFace(f);
+        std::set<uint> corners;
+        for (auto e : {q.a, q.b, q.c, q.d})
+        {
+            corners.insert(points[obj->pointsOfEdge(e).a]);
+            corners.insert(points[obj->pointsOfEdge(e).b]);
+        }
+        std::vector<uint> key(corners.begin(), corners.end());
+        faces.push_back(join(2, obj->faceCentroid(f), key, index, f));
+    }
+
+    if (obj->type() != OT_VOLUME)
+        return nInterior;
+
+    for (auto id : faces)
+    {
+        entity &e = entities[2][id];
+        if (nVolumes(e) < 2)
+            continue;
+
+        for (auto &m : e.members)
+        {
+            DisplayObject *other = DisplayObject::getObject(m.first);
+            if (other && other->type() == OT_VOLUME && !other->faceInterior(m.second))
+            {
+                other->setFaceInterior(m.second);
+                nInterior++;
+            }
+        }
+    }
+
+    return nInterior;
+}
+
+
+void Topology::remove(DisplayObject *obj)
+{
+    uint index = obj->index();
+
+    for (uint dim = 0; dim < 3; dim++)
+    {
+        auto it = objEntities[dim].find(index);
+        if (it == objEntities[dim].end())
+            continue;
+
+        for (auto id : it->second)
+            leave(dim, id, index);
+        objEntities[dim].erase(it);
+    }
+
+    if (empty())
+        tol = 0.0;
+}
+
+
+std::vector<std::pair<uint,uint>> Topology::coincident(SelectionMode mode, uint index, uint component)
+{
+    int dim = dimension(mode);
+
+    auto it = objEntities[dim].find(index);
+    if (it == objEntities[dim].end() || component >= it->second.size())
+        return {std::make_pair(index, component)};
+
+    return entities[dim][it->second[component]].members;
+}
+
+
+bool Topology::shared(SelectionMode mode, uint index, uint component)
+{
+    for (auto &m : coincident(mode, index, component))
+        if (m.first != index)
+            return true;
+    return false;
+}
+
+
+std::set<uint> Topology::connected(const std::set<uint> &indices)
+{
+    std::set<uint> found(indices);
+    std::vector<uint> queue(indices.begin(), indices.end());
+
+    while (!queue.empty())
+    {
+        uint index = queue.back();
+        queue.pop_back();
+
+        auto it = objEntities[0].find(index);
+        if (it == objEntities[0].end())
+            continue;
+
+        for (auto id : it->second)
+            for (auto &m : entities[0][id].members)
+                if (found.insert(m.first).second)
+                    queue.push_back(m.first);
+    }
+
+    return found;
+}
+
+
+uint64_t Topology::cellOf(QVector3D pos, int dx, int dy, int dz)
+{
+    int64_t x = (int64_t) floor(pos.x() / tol) + dx;
+    int64_t y = (int64_t) floor(pos.y() / tol) + dy;
+    int64_t z = (int64_t) floor(pos.z() / tol) + dz;
+
+    return ((uint64_t) x * 73856093) ^ ((uint64_t) y * 19349663) ^ ((uint64_t) z * 83492791);
+}
+
+
+uint Topology::join(uint dim, QVector3D pos, const std::vector<uint> &key, uint index, uint component)
+{
+    // Coincident positions may straddle a cell boundary, so search the neighbouring cells too
+    for (int dx = -1; dx <= 1; dx++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dz = -1; dz <= 1; dz++)
+            {
+                auto it = cells[dim].find(cellOf(pos, dx, dy, dz));
+                if (it == cells[dim].end())
+                    continue;
+
+                for (auto id : it->second)
+                {
+                    entity &e = entities[dim][id];
+                    if (e.key == key && (e.pos - pos).length() <= tol)
+                    {
+                        e.members.push_back(std::make_pair(index, component));
+                        return id;
+                    }
+                }
+            }
+
+    uint id;
+    if (!freeIds[dim].empty())
+    {
+        id = freeIds[dim].back();
+        freeIds[dim].pop_back();
+    }
+    else
+    {
+        id = entities[dim].size();
+        entities[dim].emplace_back();
+    }
+
+    entity &e = entities[dim][id];
+    e.pos = pos;
+    e.key = key;
+    e.members = {std::make_pair(index, component)};
+    cells[dim][cellOf(pos)].push_back(id);
+
+    return id;
+}
+
+
+void Topology::leave(uint dim, uint id, uint index)
+{
+    entity &e = entities[dim][id];
+    e.members.erase(std::remove_if(e.members.begin(), e.members.end(),
+                                   [index] (const std::pair<uint,uint> &m) { return m.first == index; }),
+                    e.members.end());
+
+    if (dim == 2 && nVolumes(e) < 2)
+        for (auto &m : e.members)
+        {
+            DisplayObject *other = DisplayObject::getObject(m.first);
+            if (other)
+                other->setFaceInterior(m.second, false);
+        }
+
+    if (!e.members.empty())
+        return;
+
+    auto cell = cells[dim].find(cellOf(e.pos));
+    cell->second.erase(std::find(cell->second.begin(), cell->second.end(), id));
+    if (cell->second.empty())
+        cells[dim].erase(cell);
+
+    e.key.clear();
+    freeIds[dim].push_back(id);
+}
+
+
+uint Topology::rebuild(float newTol)
+{
+    std::vector<uint> indices;
+    for (auto &o : objEntities[0])
+        indices.push_back(o.first);
+
+    tol = newTol;
+    for (uint dim = 0; dim < 3; dim++)
+    {
+        entities[dim].clear();
+        freeIds[dim].clear();
+        cells[dim].clear();
+        objEntities[dim].clear();
+    }
+
+    // Faces only become interior here, as a larger tolerance joins at least as much as before
+    uint nInterior = 0;
+    for (auto index : indices)
+    {
+        DisplayObject *obj = DisplayObject::getObject(index);
+        if (obj)
+            nInterior += add(obj);
+    }
+
+    return nInterior;
+}
+
+
+bool Topology::empty()
+{
+    return objEntities[0].empty() && objEntities[1].empty() && objEntities[2].empty();
+}
+
+
+int Topology::dimension(SelectionMode mode)
+{
+    switch (mode)
+    {
+    case SM_FACE: return 2;
+    case SM_EDGE: return 1;
+    default: return 0;
+    }
+}
+
+
+uint Topology::nVolumes(const entity &e)
+{
+    uint n = 0;
+    for (auto &m : e.members)
+    {
+        DisplayObject *obj = DisplayObject::getObject(m.first);
+        if (obj && obj->type() == OT_VOLUME)
+            n++;
+    }
+    return n;
+}
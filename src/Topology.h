@@ -0,0 +1,64 @@
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <QVector3D>
+
+#include "DisplayObject.h"
+
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+// Identifies coincident points, edges and faces across display objects. Points match if they are
+// within a tolerance of each other, edges if they have the same end points and midpoint, and
+// faces if they have the same corners and centroid. Objects are added and removed one at a time,
+// so reloading a file only touches its own patches. The caller must hold DisplayObject::m.
+class Topology
+{
+public:
+    Topology() : tol(0.0) { }
+    ~Topology() { }
+
+    // Adds or removes the components of an object. Volume faces that coincide with a face of
+    // another volume are marked as interior. Returns the number of newly interior faces.
+    uint add(DisplayObject *obj);
+    void remove(DisplayObject *obj);
+
+    // All components coincident with the given one, including itself, as (object index, component)
+    // pairs. The mode must be SM_FACE, SM_EDGE or SM_POINT.
+    std::vector<std::pair<uint,uint>> coincident(SelectionMode mode, uint index, uint component);
+    bool shared(SelectionMode mode, uint index, uint component);
+
+    // The indices of all objects connected to the given ones through shared points
+    std::set<uint> connected(const std::set<uint> &indices);
+
+private:
+    // A class of coincident components. For edges and faces, key holds the sorted point entities
+    // at the corners.
+    typedef struct
+    {
+        QVector3D pos;
+        std::vector<uint> key;
+        std::vector<std::pair<uint,uint>> members;
+    } entity;
+
+    float tol;
+
+    // Indexed by dimension: points, edges and faces
+    std::vector<entity> entities[3];
+    std::vector<uint> freeIds[3];
+    std::unordered_map<uint64_t, std::vector<uint>> cells[3];
+    std::unordered_map<uint, std::vector<uint>> objEntities[3];
+
+    uint64_t cellOf(QVector3D pos, int dx = 0, int dy = 0, int dz = 0);
+    uint join(uint dim, QVector3D pos, const std::vector<uint> &key, uint index, uint component);
+    void leave(uint dim, uint id, uint index);
+    // Joins all objects again with a new tolerance, returning the number of newly interior faces
+    uint rebuild(float newTol);
+    bool empty();
+
+    static int dimension(SelectionMode mode);
+    static uint nVolumes(const entity &e);
+};
+
+#endif /* _TOPOLOGY_H_ */
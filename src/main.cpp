@@ -1,18 +1,36 @@
+#include <cstring>
 #include <thread>
 #include <QApplication>
-#include <QGLFormat>
+#include <QSurfaceFormat>
 
 #include "MainWindow.h"
 
 
 int main(int argc, char **argv)
 {
-    QGLFormat fmt;
-    fmt.setRgba(true);
-    fmt.setAlpha(true);
-    fmt.setDepth(true);
-    fmt.setDoubleBuffer(true);
-    QGLFormat::setDefaultFormat(fmt);
+    // The legacy renderer needs a compatibility context, the core profile renderer is
+    // selected with --core
+    bool core = false;
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "--core"))
+            core = true;
+
+    QSurfaceFormat fmt;
+    fmt.setRenderableType(QSurfaceFormat::OpenGL);
+    fmt.setAlphaBufferSize(8);
+    fmt.setDepthBufferSize(24);
+    fmt.setSwapBehavior(QSurfaceFormat::DoubleBuffer);
+    if (core)
+    {
+        fmt.setVersion(4, 1);
+        fmt.setProfile(QSurfaceFormat::CoreProfile);
+    }
+    else
+    {
+        fmt.setVersion(3, 0);
+        fmt.setProfile(QSurfaceFormat::CompatibilityProfile);
+    }
+    QSurfaceFormat::setDefaultFormat(fmt);
 
     QApplication app(argc, argv);
 
@@ -20,7 +38,8 @@ int main(int argc, char **argv)
     window.showMaximized();
 
     for (int i = 1; i < argc; i++)
-        window.objectSet()->loadFile(argv[i]);
+        if (strcmp(argv[i], "--core"))
+            window.objectSet()->loadFile(argv[i]);
 
     return app.exec();
 }